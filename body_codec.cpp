@@ -0,0 +1,400 @@
+/*
+
+Text Template Keeper library - Body Codec.
+
+Copyright (C) 2015 Sergey Kolevatov
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// $Revision: 8742 $ $Date:: 2018-03-12 #$ $Author: serge $
+
+#include "body_codec.h"                 // self
+
+#include <cstring>                      // memcpy
+#include <stdexcept>                    // std::runtime_error
+#include <unordered_map>                // std::unordered_map
+#include <queue>                        // std::priority_queue
+#include <algorithm>                    // std::min
+
+NAMESPACE_TEMPLTEXTKEEPER_START
+
+const uint32_t BodyCodec::MIN_MATCH;
+const uint32_t BodyCodec::HASH_BITS;
+const uint32_t BodyCodec::MAX_CHAIN;
+const uint32_t BodyCodec::NO_POS;
+
+BodyCodec::BodyCodec()
+{
+}
+
+BodyCodec::BodyCodec( const std::string & dict ):
+        dict_( dict ),
+        dict_head_( 1 << HASH_BITS, NO_POS ),
+        dict_chain_( dict.size(), NO_POS )
+{
+    for( uint32_t i = 0; i + MIN_MATCH <= dict_.size(); ++i )
+    {
+        auto h = hash4( & dict_[i] ) >> ( 32 - HASH_BITS );
+
+        dict_chain_[i]  = dict_head_[h];
+        dict_head_[h]   = i;
+    }
+}
+
+const std::string & BodyCodec::get_dictionary() const
+{
+    return dict_;
+}
+
+std::string BodyCodec::compress( const std::string & s ) const
+{
+    // format: raw_size { literal_len literals match_len [offset] }, match_len 0 terminates
+
+    std::string res;
+
+    res.reserve( s.size() / 2 + 8 );
+
+    write_varint( res, s.size() );
+
+    uint32_t dict_size  = dict_.size();
+    uint32_t size       = s.size();
+
+    uint32_t local_bits = 4;
+
+    while( local_bits < HASH_BITS && ( 1u << local_bits ) < size )
+        ++local_bits;
+
+    std::vector<uint32_t> local_head( 1 << local_bits, NO_POS );
+    std::vector<uint32_t> local_chain( size, NO_POS );
+
+    auto at = [&]( uint32_t vpos ) -> char
+    {
+        return vpos < dict_size ? dict_[vpos] : s[vpos - dict_size];
+    };
+
+    auto match_length = [&]( uint32_t vpos, uint32_t i ) -> uint32_t
+    {
+        uint32_t len = 0;
+
+        while( i + len < size && at( vpos + len ) == s[i + len] )
+            ++len;
+
+        return len;
+    };
+
+    auto insert = [&]( uint32_t i )
+    {
+        auto h = hash4( & s[i] ) >> ( 32 - local_bits );
+
+        local_chain[i]  = local_head[h];
+        local_head[h]   = i;
+    };
+
+    uint32_t i          = 0;
+    uint32_t lit_start  = 0;
+
+    while( i + MIN_MATCH <= size )
+    {
+        auto h = hash4( & s[i] );
+
+        uint32_t best_len = 0;
+        uint32_t best_pos = 0;
+
+        auto p = local_head[ h >> ( 32 - local_bits ) ];
+
+        for( uint32_t depth = 0; p != NO_POS && depth < MAX_CHAIN; ++depth, p = local_chain[p] )
+        {
+            auto len = match_length( dict_size + p, i );
+
+            if( len > best_len )
+            {
+                best_len = len;
+                best_pos = dict_size + p;
+            }
+        }
+
+        if( dict_size )
+        {
+            p = dict_head_[ h >> ( 32 - HASH_BITS ) ];
+
+            for( uint32_t depth = 0; p != NO_POS && depth < MAX_CHAIN; ++depth, p = dict_chain_[p] )
+            {
+                auto len = match_length( p, i );
+
+                if( len > best_len )
+                {
+                    best_len = len;
+                    best_pos = p;
+                }
+            }
+        }
+
+        if( best_len < MIN_MATCH )
+        {
+            insert( i );
+            ++i;
+            continue;
+        }
+
+        write_varint( res, i - lit_start );
+        res.append( s, lit_start, i - lit_start );
+        write_varint( res, best_len - MIN_MATCH + 1 );
+        write_varint( res, dict_size + i - best_pos );
+
+        for( uint32_t k = 0; k < best_len && i + k + MIN_MATCH <= size; ++k )
+            insert( i + k );
+
+        i          += best_len;
+        lit_start   = i;
+    }
+
+    write_varint( res, size - lit_start );
+    res.append( s, lit_start, size - lit_start );
+    write_varint( res, 0 );
+
+    return res;
+}
+
+std::string BodyCodec::decompress( const std::string & packed ) const
+{
+    size_t pos = 0;
+
+    std::string res;
+
+    res.reserve( read_varint( packed, pos ) );
+
+    uint32_t dict_size = dict_.size();
+
+    while( true )
+    {
+        auto lit_len = read_varint( packed, pos );
+
+        if( pos + lit_len > packed.size() )
+            throw std::runtime_error( "corrupted compressed body: literals out of range" );
+
+        res.append( packed, pos, lit_len );
+        pos += lit_len;
+
+        auto match_len = read_varint( packed, pos );
+
+        if( match_len == 0 )
+            break;
+
+        match_len += MIN_MATCH - 1;
+
+        auto offset = read_varint( packed, pos );
+
+        uint32_t vsize = dict_size + res.size();
+
+        if( offset == 0 || offset > vsize )
+            throw std::runtime_error( "corrupted compressed body: invalid offset " + std::to_string( offset ) );
+
+        auto src = vsize - offset;
+
+        for( uint32_t k = 0; k < match_len; ++k, ++src )
+        {
+            res.push_back( src < dict_size ? dict_[src] : res[src - dict_size] );
+        }
+    }
+
+    return res;
+}
+
+uint32_t BodyCodec::get_raw_size( const std::string & packed )
+{
+    size_t pos = 0;
+
+    return read_varint( packed, pos );
+}
+
+std::string BodyCodec::train_dictionary( const std::vector<std::string> & samples, uint32_t max_size )
+{
+    // simplified COVER algorithm: pick the segments with the highest total frequency of their d-grams,
+    // d-grams of a picked segment don't score anymore
+
+    static const uint32_t SEGMENT_SIZE  = 32;
+    static const uint32_t GRAM_SIZE     = 8;
+
+    struct Segment
+    {
+        uint32_t    sample;
+        uint32_t    begin;
+        uint32_t    len;
+    };
+
+    uint64_t total_size = 0;
+
+    for( auto & s : samples )
+        total_size += s.size();
+
+    // don't analyze more than 100 times of the dictionary size
+    uint64_t max_sample_size = uint64_t( max_size ) * 100;
+
+    uint32_t stride = total_size > max_sample_size ? uint32_t( total_size / max_sample_size ) + 1 : 1;
+
+    auto gram_at = []( const std::string & s, uint32_t pos ) -> uint64_t
+    {
+        uint64_t res;
+        memcpy( & res, & s[pos], GRAM_SIZE );
+        return res;
+    };
+
+    std::unordered_map<uint64_t, uint32_t> freq;
+
+    std::vector<Segment> segments;
+
+    for( uint32_t i = 0; i < samples.size(); i += stride )
+    {
+        auto & s = samples[i];
+
+        if( s.size() < GRAM_SIZE )
+            continue;
+
+        for( uint32_t pos = 0; pos + GRAM_SIZE <= s.size(); ++pos )
+            ++freq[ gram_at( s, pos ) ];
+
+        for( uint32_t begin = 0; begin + GRAM_SIZE <= s.size(); begin += SEGMENT_SIZE / 2 )
+        {
+            Segment seg;
+
+            seg.sample  = i;
+            seg.begin   = begin;
+            seg.len     = std::min<uint32_t>( SEGMENT_SIZE, s.size() - begin );
+
+            segments.push_back( seg );
+        }
+    }
+
+    auto score = [&]( const Segment & seg ) -> uint64_t
+    {
+        auto & s = samples[ seg.sample ];
+
+        uint64_t res = 0;
+
+        for( uint32_t pos = seg.begin; pos + GRAM_SIZE <= seg.begin + seg.len; ++pos )
+        {
+            auto f = freq[ gram_at( s, pos ) ];
+
+            if( f > 1 )
+                res += f - 1;
+        }
+
+        return res;
+    };
+
+    typedef std::pair<uint64_t, uint32_t> ScoreToSegment;
+
+    std::priority_queue<ScoreToSegment> queue;
+
+    for( uint32_t i = 0; i < segments.size(); ++i )
+    {
+        auto sc = score( segments[i] );
+
+        if( sc > 0 )
+            queue.push( ScoreToSegment( sc, i ) );
+    }
+
+    std::vector<uint32_t> picked;
+
+    uint32_t dict_size = 0;
+
+    while( queue.empty() == false && dict_size < max_size )
+    {
+        auto top = queue.top();
+        queue.pop();
+
+        auto & seg = segments[ top.second ];
+
+        auto sc = score( seg );
+
+        if( sc == 0 )
+            continue;
+
+        if( sc < top.first )
+        {
+            // score is outdated, reconsider later
+            queue.push( ScoreToSegment( sc, top.second ) );
+            continue;
+        }
+
+        picked.push_back( top.second );
+        dict_size += seg.len;
+
+        auto & s = samples[ seg.sample ];
+
+        for( uint32_t pos = seg.begin; pos + GRAM_SIZE <= seg.begin + seg.len; ++pos )
+            freq[ gram_at( s, pos ) ] = 0;
+    }
+
+    // the best segments go to the end of the dictionary, so that they get the shortest offsets
+
+    std::string res;
+
+    res.reserve( dict_size );
+
+    for( auto it = picked.rbegin(); it != picked.rend(); ++it )
+    {
+        auto & seg = segments[ * it ];
+
+        res.append( samples[ seg.sample ], seg.begin, seg.len );
+    }
+
+    if( res.size() > max_size )
+        res.erase( 0, res.size() - max_size );
+
+    return res;
+}
+
+uint32_t BodyCodec::hash4( const char * p )
+{
+    uint32_t v;
+    memcpy( & v, p, sizeof( v ) );
+
+    return v * 2654435761u;
+}
+
+void BodyCodec::write_varint( std::string & res, uint32_t v )
+{
+    while( v >= 0x80 )
+    {
+        res.push_back( char( v | 0x80 ) );
+        v >>= 7;
+    }
+
+    res.push_back( char( v ) );
+}
+
+uint32_t BodyCodec::read_varint( const std::string & s, size_t & pos )
+{
+    uint32_t res = 0;
+
+    for( uint32_t shift = 0; shift < 35; shift += 7 )
+    {
+        if( pos >= s.size() )
+            throw std::runtime_error( "corrupted compressed body: unexpected end" );
+
+        auto b = static_cast<uint8_t>( s[pos++] );
+
+        res |= uint32_t( b & 0x7F ) << shift;
+
+        if( ( b & 0x80 ) == 0 )
+            return res;
+    }
+
+    throw std::runtime_error( "corrupted compressed body: invalid varint" );
+}
+
+NAMESPACE_TEMPLTEXTKEEPER_END
@@ -0,0 +1,83 @@
+/*
+
+Text Template Keeper library - Body Codec.
+
+Copyright (C) 2015 Sergey Kolevatov
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// $Revision: 8742 $ $Date:: 2018-03-12 #$ $Author: serge $
+
+#ifndef LIB_TEMPLTEXTKEEPER_BODY_CODEC_H
+#define LIB_TEMPLTEXTKEEPER_BODY_CODEC_H
+
+#include <string>                   // std::string
+#include <vector>                   // std::vector
+#include <cstdint>                  // std::uint32_t
+
+#include "namespace_lib.h"          // NAMESPACE_TEMPLTEXTKEEPER_START
+
+NAMESPACE_TEMPLTEXTKEEPER_START
+
+/**
+ * @brief LZ77 compressor of short template bodies with a shared dictionary.
+ *
+ * Each body is compressed independently, matches may refer to the dictionary,
+ * which is trained once on the catalog (boilerplate shared across templates and locales).
+ */
+class BodyCodec
+{
+public:
+
+    BodyCodec();
+    explicit BodyCodec( const std::string & dict );
+
+    /**
+     * @brief builds a dictionary of the most frequent segments of the samples
+     */
+    static std::string train_dictionary( const std::vector<std::string> & samples, uint32_t max_size = 64 * 1024 );
+
+    const std::string & get_dictionary() const;
+
+    std::string compress( const std::string & s ) const;
+    std::string decompress( const std::string & packed ) const;
+
+    static uint32_t get_raw_size( const std::string & packed );
+
+private:
+
+    static const uint32_t MIN_MATCH     = 4;
+    static const uint32_t HASH_BITS     = 16;
+    static const uint32_t MAX_CHAIN     = 16;
+    static const uint32_t NO_POS        = 0xFFFFFFFF;
+
+private:
+
+    static uint32_t hash4( const char * p );
+
+    static void write_varint( std::string & res, uint32_t v );
+    static uint32_t read_varint( const std::string & s, size_t & pos );
+
+private:
+
+    std::string             dict_;
+    std::vector<uint32_t>   dict_head_;     // hash --> last dictionary position
+    std::vector<uint32_t>   dict_chain_;    // dictionary position --> previous position with the same hash
+};
+
+NAMESPACE_TEMPLTEXTKEEPER_END
+
+#endif // LIB_TEMPLTEXTKEEPER_BODY_CODEC_H
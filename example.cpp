@@ -22,10 +22,20 @@ along with this program. If not, see <http://www.gnu.org/licenses/>.
 // $Revision: 8373 $ $Date:: 2017-11-15 #$ $Author: serge $
 
 #include <cstdio>
+#include <cmath>                            // std::pow
 #include <sstream>                          // std::stringstream
 #include <iostream>                         // std::cout
+#include <fstream>                          // std::ofstream
+#include <chrono>                           // std::chrono
+#include <random>                           // std::mt19937
+#include <algorithm>                        // std::shuffle
+#include <thread>                           // std::thread
+#include <atomic>                           // std::atomic
+#include <unistd.h>                         // fork
+#include <sys/wait.h>                       // waitpid
 
 #include "templtextkeeper.h"                // TemplTextKeeper
+#include "shm_templtextkeeper.h"            // ShmTemplTextKeeper
 
 #include "../lang_tools/str_helper.h"       // lang_tools::to_string_iso
 
@@ -279,7 +289,1059 @@ void test_14_find_templates( const templtextkeeper::TemplTextKeeper & ttk )
     print( total_size, info );
 }
 
-int main()
+void test_15_format_slots( const templtextkeeper::TemplTextKeeper & ttk )
+{
+    std::cout << "TEST 15" << std::endl;
+
+    auto slot_salutation    = ttk.get_slot( "SALUTATION" );
+    auto slot_name          = ttk.get_slot( "NAME" );
+    auto slot_text          = ttk.get_slot( "TEXT" );
+
+    if( slot_salutation == templtextkeeper::SlotTempl::INVALID_SLOT
+            || slot_name == templtextkeeper::SlotTempl::INVALID_SLOT
+            || slot_text == templtextkeeper::SlotTempl::INVALID_SLOT )
+    {
+        std::cout << "ERROR: unknown placeholder" << std::endl;
+        return;
+    }
+
+    templtextkeeper::TemplTextKeeper::Args args( ttk.get_slot_count() );
+
+    args[ slot_salutation ] = "Mr.";
+    args[ slot_name ]       = "John Doe";
+    args[ slot_text ]       = "Hello World";
+
+    try
+    {
+        std::string res = ttk.format( 3, lang_tools::lang_e::EN, args );
+
+        if( res == "Hello. Mr. John Doe is greeting you. Hello World." )
+            std::cout << "OK: formatted string is '" << res << "'" << std::endl;
+        else
+            std::cout << "ERROR: unexpected formatted string '" << res << "'" << std::endl;
+    }
+    catch ( std::exception & e )
+    {
+        std::cout << "ERROR: got exception '" << e.what() << "'" << std::endl;
+    }
+}
+
+void test_15_b_parsers()
+{
+    std::cout << "TEST 15 b" << std::endl;
+
+    // SlotTempl must accept and reject the same bodies as templtext and find the same placeholders
+
+    const std::vector<std::string> bodies =
+    {
+        "Hello ${NAME",
+        "Hello ${NAME, $TEXT",
+        "${",
+        "Dear ${NAME}, ${",
+        "${NAME}${TEXT}",
+        "$NAME$TEXT",
+        "Price: 5$",
+    };
+
+    unsigned num_errors = 0;
+
+    for( auto & b : bodies )
+    {
+        std::string error_t;
+        std::string error_st;
+
+        std::set<std::string> placeholders_t;
+        std::set<std::string> placeholders_st;
+
+        try
+        {
+            templtext::Templ t( b, "test" );
+
+            placeholders_t  = t.get_placeholders();
+        }
+        catch( std::exception & e )
+        {
+            error_t = e.what();
+        }
+
+        try
+        {
+            templtextkeeper::SlotTempl::MapNameToSlot registry;
+
+            templtextkeeper::SlotTempl st( b, registry );
+
+            for( auto & r : registry )
+                placeholders_st.insert( r.first );
+        }
+        catch( std::exception & e )
+        {
+            error_st = e.what();
+        }
+
+        if( error_t.empty() != error_st.empty() || placeholders_t != placeholders_st )
+        {
+            ++num_errors;
+
+            std::cout << "ERROR: '" << b << "': templtext " << ( error_t.empty() ? show_placeholders( placeholders_t ) : error_t )
+                    << ", slot template " << ( error_st.empty() ? show_placeholders( placeholders_st ) : error_st ) << std::endl;
+        }
+    }
+
+    // a catalog with a malformed body is rejected at load
+
+    const std::string config_file = "example_malformed.csv";
+
+    {
+        std::ofstream os( config_file );
+
+        os << "T;1;1;Malformed\n";
+        os << "L;1;en;Malformed;Hello ${NAME\n";
+    }
+
+    bool is_rejected = false;
+
+    for( auto is_compressed : { false, true } )
+    {
+        templtextkeeper::TemplTextKeeper ttk;
+
+        try
+        {
+            ttk.init( config_file, is_compressed );
+        }
+        catch( std::exception & )
+        {
+            is_rejected = true;
+            continue;
+        }
+
+        is_rejected = false;
+        break;
+    }
+
+    std::remove( config_file.c_str() );
+
+    if( num_errors == 0 && is_rejected )
+        std::cout << "OK: " << bodies.size() << " malformed and valid bodies parsed alike, malformed catalog rejected" << std::endl;
+    else
+        std::cout << "ERROR: " << num_errors << " bodies parsed differently, malformed catalog rejected " << is_rejected << std::endl;
+}
+
+void test_16_format_names( const templtextkeeper::TemplTextKeeper & ttk )
+{
+    std::cout << "TEST 16" << std::endl;
+
+    templtext::Templ::MapKeyValue tokens  =
+    {
+            { "SALUTATION", "Mr." },
+            { "NAME", "John Doe" },
+    };
+
+    try
+    {
+        std::string res = ttk.format( 3, lang_tools::lang_e::DE, tokens );
+
+        std::cout << "ERROR: formatted string is '" << res << "'" << std::endl;
+    }
+    catch ( std::exception & e )
+    {
+        std::cout << "OK: got exception '" << e.what() << "'" << std::endl;
+    }
+}
+
+void test_16_b_format_names( const templtextkeeper::TemplTextKeeper & ttk )
+{
+    std::cout << "TEST 16 b" << std::endl;
+
+    templtext::Templ::MapKeyValue tokens  =
+    {
+            { "SALUTATION", "Mr." },
+            { "NAME", "John Doe" },
+            { "TEXT", "Hello World" },
+            { "UNUSED", "unused" },
+    };
+
+    std::string res = ttk.format( 3, lang_tools::lang_e::EN, tokens );
+
+    if( res == "Hello. Mr. John Doe is greeting you. Hello World." )
+        std::cout << "OK: formatted string is '" << res << "'" << std::endl;
+    else
+        std::cout << "ERROR: formatted string is '" << res << "'" << std::endl;
+}
+
+void test_17_search_templates( const templtextkeeper::TemplTextKeeper & ttk )
+{
+    std::cout << "TEST 17: search with a typo" << std::endl;
+
+    auto info = ttk.search_templates( "greting", 0, lang_tools::lang_e::UNDEF );
+
+    print( info.size(), info );
+}
+
+void test_18_search_templates( const templtextkeeper::TemplTextKeeper & ttk )
+{
+    std::cout << "TEST 18: search by prefix" << std::endl;
+
+    auto info = ttk.search_templates( "begr dat", 0, lang_tools::lang_e::DE );
+
+    print( info.size(), info );
+}
+
+void test_19_issues()
+{
+    std::cout << "TEST 19" << std::endl;
+
+    templtextkeeper::TemplTextKeeper ttk;
+
+    ttk.set_known_functions( { "foo" } );
+
+    ttk.init( "templates.csv" );
+
+    auto issues = ttk.get_issues();
+
+    for( auto & e : issues )
+    {
+        std::cout << "issue: id " << e.id << " " << lang_tools::to_string_iso( e.locale ) << " " << e.message << std::endl;
+    }
+
+    std::cout << "OK: got " << issues.size() << " issue(s)" << std::endl;
+}
+
+void test_19_b_issues()
+{
+    std::cout << "TEST 19 b" << std::endl;
+
+    const std::string config_file = "example_lint.csv";
+
+    {
+        std::ofstream os( config_file );
+
+        os << "T;1;1;Nested\n";
+        os << "T;2;1;Placeholder\n";
+        os << "T;3;1;Empty\n";
+        os << "L;1;en;Nested;%foo( %foo( x ) and more\n";
+        os << "L;1;de;Nested;%foo( %foo( x ) ) und mehr\n";
+        os << "L;2;en;Placeholder;Hello $TEXT\n";
+        os << "L;2;de;Placeholder;Hallo ${NAME}, $TEXT\n";
+    }
+
+    templtextkeeper::TemplTextKeeper ttk;
+
+    ttk.set_known_functions( { "foo" } );
+
+    ttk.init( config_file );
+
+    std::remove( config_file.c_str() );
+
+    auto issues = ttk.get_issues();
+
+    for( auto & e : issues )
+    {
+        std::cout << "issue: id " << e.id << " " << lang_tools::to_string_iso( e.locale ) << " " << e.message << std::endl;
+    }
+
+    if( issues.size() == 3 )
+        std::cout << "OK: got " << issues.size() << " issue(s)" << std::endl;
+    else
+        std::cout << "ERROR: got " << issues.size() << " issue(s), expected 3" << std::endl;
+}
+
+void test_20_shared_memory( const templtextkeeper::TemplTextKeeper & ttk )
+{
+    std::cout << "TEST 20" << std::endl;
+
+    const std::string shm_name = "/templtextkeeper_example";
+
+    auto gen = templtextkeeper::ShmTemplTextKeeper::publish( shm_name, ttk );
+
+    auto pid = fork();
+
+    if( pid == 0 )
+    {
+        // worker process
+        templtextkeeper::ShmTemplTextKeeper shm;
+
+        shm.attach( shm_name );
+
+        uint32_t total;
+
+        shm.find_templates( & total, 0, "", lang_tools::lang_e::UNDEF );
+
+        auto t = shm.get_template( 3, lang_tools::lang_e::EN );
+
+        std::cout << "worker: generation " << shm.get_generation() << ", " << total << " templates, "
+                << "id of 'Text04' " << shm.find_template_id_by_name( "Text04" ) << ", "
+                << "template 3 en '" << ( t ? t->get_template() : "" ) << "'" << std::endl;
+
+        _exit( shm.has_template( 3, lang_tools::lang_e::RU ) ? 1 : 0 );
+    }
+
+    int status = 0;
+
+    waitpid( pid, & status, 0 );
+
+    templtextkeeper::ShmTemplTextKeeper shm;
+
+    shm.attach( shm_name );
+
+    auto is_refreshed_1 = shm.refresh();
+
+    templtextkeeper::ShmTemplTextKeeper::publish( shm_name, ttk );
+
+    auto is_refreshed_2 = shm.refresh();
+
+    if( WIFEXITED( status ) && WEXITSTATUS( status ) == 0 && is_refreshed_1 == false && is_refreshed_2 && shm.get_generation() == gen + 1 )
+        std::cout << "OK: switched to generation " << shm.get_generation() << std::endl;
+    else
+        std::cout << "ERROR: status " << status << ", generation " << shm.get_generation() << std::endl;
+
+    templtextkeeper::ShmTemplTextKeeper::remove( shm_name );
+}
+
+void test_20_b_shared_memory_names()
+{
+    std::cout << "TEST 20 b" << std::endl;
+
+    const std::string filename  = "example_shm.csv";
+    const std::string shm_name  = "/templtextkeeper_example_b";
+
+    {
+        std::ofstream os( filename );
+
+        os << "T;1;1;Empty;\n";
+        os << "T;2;1;Full;\n";
+        os << "L;2;en;Full;Hello $NAME.\n";
+    }
+
+    templtextkeeper::TemplTextKeeper ttk;
+
+    ttk.init( filename );
+
+    std::remove( filename.c_str() );
+
+    templtextkeeper::ShmTemplTextKeeper::publish( shm_name, ttk );
+
+    templtextkeeper::ShmTemplTextKeeper shm;
+
+    shm.attach( shm_name );
+
+    // the image contains only templates with localized versions
+    auto id_empty   = shm.find_template_id_by_name( "Empty" );
+    auto id_full    = shm.find_template_id_by_name( "Full" );
+
+    // compiled on first use, then returned from the cache
+    auto t1 = shm.get_template( 2, lang_tools::lang_e::EN );
+    auto t2 = shm.get_template( 2, lang_tools::lang_e::EN );
+
+    templtextkeeper::ShmTemplTextKeeper::remove( shm_name );
+
+    if( ttk.find_template_id_by_name( "Empty" ) == 1 && id_empty == 0 && id_full == 2
+            && t1 && t1 == t2 && t1->get_template() == "Hello $NAME." && shm.get_template( 1, lang_tools::lang_e::EN ) == nullptr )
+        std::cout << "OK: template without localized versions is not in the image" << std::endl;
+    else
+        std::cout << "ERROR: id of 'Empty' " << id_empty << ", id of 'Full' " << id_full << ", cached " << ( t1 == t2 ) << std::endl;
+}
+
+void test_21_compressed_bodies()
+{
+    std::cout << "TEST 21" << std::endl;
+
+    templtextkeeper::TemplTextKeeper plain;
+    templtextkeeper::TemplTextKeeper compressed;
+
+    plain.init( "templates.csv" );
+    compressed.init( "templates.csv", true );
+
+    uint32_t total_plain;
+    uint32_t total_compressed;
+
+    auto records_plain      = plain.find_templates( & total_plain, 0, "", lang_tools::lang_e::UNDEF );
+    auto records_compressed = compressed.find_templates( & total_compressed, 0, "", lang_tools::lang_e::UNDEF );
+
+    unsigned num_errors = ( total_plain == total_compressed && records_plain.size() == records_compressed.size() ) ? 0 : 1;
+
+    for( size_t i = 0; i < records_plain.size() && num_errors == 0; ++i )
+    {
+        auto & r    = records_plain[i];
+        auto & rc   = records_compressed[i];
+
+        auto t  = plain.get_template( r.id, r.locale );
+        auto tc = compressed.get_template( rc.id, rc.locale );
+
+        if( r.id != rc.id || r.locale != rc.locale || r.templ != rc.templ
+                || t == nullptr || tc == nullptr
+                || t->get_template() != r.templ || tc->get_template() != r.templ )
+        {
+            std::cout << "ERROR: template " << r.id << " " << lang_tools::to_string_iso( r.locale ) << " differs" << std::endl;
+            ++num_errors;
+        }
+    }
+
+    if( num_errors == 0 )
+        std::cout << "OK: " << records_plain.size() << " templates are identical in plain and compressed mode" << std::endl;
+}
+
+void test_22_profile()
+{
+    std::cout << "TEST 22" << std::endl;
+
+    const std::string profile_file = "example_profile.csv";
+
+    templtextkeeper::TemplTextKeeper ttk;
+
+    ttk.init( "templates.csv" );
+
+    ttk.set_access_sampling( 1 );
+
+    for( unsigned i = 0; i < 3; ++i )
+        ttk.get_template( 3, lang_tools::lang_e::EN );
+
+    ttk.get_template( 1, lang_tools::lang_e::DE );
+
+    // lookups of nonexistent templates are not counted
+    for( unsigned i = 0; i < 100; ++i )
+        ttk.get_template( 1000 + i, lang_tools::lang_e::EN );
+
+    bool is_saved   = ttk.save_profile( profile_file );
+
+    unsigned num_entries = 0;
+
+    {
+        std::ifstream is( profile_file );
+
+        std::string l;
+
+        while( std::getline( is, l ) )
+        {
+            if( l.empty() == false && l[0] == 'P' )
+                ++num_entries;
+        }
+    }
+
+    bool is_loaded  = ttk.load_profile( profile_file );
+
+    {
+        std::ofstream os( profile_file );
+
+        os << "P;3;en;many\n";
+    }
+
+    bool is_invalid_loaded  = ttk.load_profile( profile_file );
+    bool is_missing_loaded  = ttk.load_profile( "nonexistent_profile.csv" );
+
+    std::remove( profile_file.c_str() );
+
+    if( is_saved && is_loaded && is_invalid_loaded == false && is_missing_loaded == false && num_entries == 2 )
+        std::cout << "OK: profile saved and loaded, invalid and missing profiles rejected" << std::endl;
+    else
+        std::cout << "ERROR: saved " << is_saved << ", loaded " << is_loaded
+                << ", invalid loaded " << is_invalid_loaded << ", missing loaded " << is_missing_loaded
+                << ", entries " << num_entries << ", expected 2" << std::endl;
+}
+
+void test_22_b_profile_concurrent_lookups()
+{
+    std::cout << "TEST 22 b" << std::endl;
+
+    // the hot table is replaced while other threads look up templates
+
+    const std::string profile_file_1 = "example_profile_1.csv";
+    const std::string profile_file_2 = "example_profile_2.csv";
+
+    {
+        std::ofstream os_1( profile_file_1 );
+        std::ofstream os_2( profile_file_2 );
+
+        os_1 << "P;3;en;10\nP;1;de;5\n";
+        os_2 << "P;4;de;10\nP;3;de;7\nP;1;en;3\n";
+    }
+
+    templtextkeeper::TemplTextKeeper ttk;
+
+    ttk.init( "templates.csv" );
+
+    const std::vector<std::pair<id_t, lang_tools::lang_e>> keys =
+    {
+        { 1, lang_tools::lang_e::EN }, { 1, lang_tools::lang_e::DE }, { 3, lang_tools::lang_e::EN },
+        { 3, lang_tools::lang_e::DE }, { 4, lang_tools::lang_e::DE }
+    };
+
+    std::vector<std::string> expected;
+
+    for( auto & k : keys )
+        expected.push_back( ttk.get_template( k.first, k.second )->get_template() );
+
+    std::atomic<bool>       is_done( false );
+    std::atomic<unsigned>   num_errors( 0 );
+
+    auto reader = [&]()
+    {
+        while( is_done == false )
+        {
+            for( size_t i = 0; i < keys.size(); ++i )
+            {
+                auto t = ttk.get_template( keys[i].first, keys[i].second );
+
+                if( t == nullptr || t->get_template() != expected[i] )
+                    ++num_errors;
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+
+    for( unsigned i = 0; i < 2; ++i )
+        threads.push_back( std::thread( reader ) );
+
+    for( unsigned i = 0; i < 200; ++i )
+        ttk.load_profile( i % 2 ? profile_file_1 : profile_file_2 );
+
+    is_done = true;
+
+    for( auto & t : threads )
+        t.join();
+
+    std::remove( profile_file_1.c_str() );
+    std::remove( profile_file_2.c_str() );
+
+    if( num_errors == 0 )
+        std::cout << "OK: lookups consistent while the profile is reloaded" << std::endl;
+    else
+        std::cout << "ERROR: " << num_errors << " wrong lookups while the profile is reloaded" << std::endl;
+}
+
+void write_catalog( const std::string & filename, const std::vector<std::string> & lines )
+{
+    std::ofstream os( filename );
+
+    for( auto & l : lines )
+        os << l << "\n";
+}
+
+bool reload_throws( templtextkeeper::TemplTextKeeper & ttk )
+{
+    try
+    {
+        ttk.reload();
+    }
+    catch( std::exception & e )
+    {
+        std::cout << "reload error: " << e.what() << std::endl;
+
+        return true;
+    }
+
+    return false;
+}
+
+std::string to_string( const templtextkeeper::TemplTextKeeper & ttk )
+{
+    std::stringstream os;
+
+    uint32_t total_size;
+
+    for( auto & e : ttk.find_templates( & total_size, 0, "", lang_tools::lang_e::UNDEF ) )
+    {
+        os << e.id << ";" << e.category_id << ";" << e.name << ";" << lang_tools::to_string_iso( e.locale ) << ";"
+                << e.localized_name << ";" << e.templ << ";" << ttk.find_template_id_by_name( e.name ) << "\n";
+    }
+
+    for( auto & i : ttk.get_issues() )
+        os << "issue " << i.id << " " << lang_tools::to_string_iso( i.locale ) << " " << i.message << "\n";
+
+    return os.str();
+}
+
+void test_23_reload()
+{
+    std::cout << "TEST 23" << std::endl;
+
+    const std::string filename = "example_reload.csv";
+
+    for( auto is_compressed : { false, true } )
+    {
+        write_catalog( filename, {
+            "T;1;1;Greeting;",
+            "L;1;en;Greeting;Hello $NAME.",
+            "L;1;de;Begrüßung;Hallo $NAME.",
+            "T;2;1;Farewell;",
+            "L;2;en;Farewell;Bye $NAME.",
+            "T;3;2;Note;",
+            "L;3;en;Note;$TEXT" } );
+
+        templtextkeeper::TemplTextKeeper ttk;
+
+        ttk.init( filename, is_compressed );
+
+        // builds the search index, so that reload() has to update it
+        ttk.search_templates( "Farewell", 0, lang_tools::lang_e::UNDEF );
+
+        // template 3 is removed, 2 is renamed, the body of 1 de is changed
+
+        write_catalog( filename, {
+            "T;1;1;Greeting;",
+            "L;1;en;Greeting;Hello $NAME.",
+            "L;1;de;Begrüßung;Hallo $NAME!!",
+            "T;2;1;Goodbye;",
+            "L;2;en;Farewell;Bye $NAME." } );
+
+        bool is_reloaded = ttk.reload();
+
+        templtext::Templ::MapKeyValue tokens = { { "NAME", "John" } };
+
+        auto found = ttk.search_templates( "Goodbye", 0, lang_tools::lang_e::UNDEF );
+
+        bool is_ok = is_reloaded
+                && ttk.has_template( 3, lang_tools::lang_e::EN ) == false
+                && ttk.find_template_id_by_name( "Note" ) == 0
+                && ttk.find_template_id_by_name( "Farewell" ) == 0
+                && ttk.find_template_id_by_name( "Goodbye" ) == 2
+                && ttk.format( 1, lang_tools::lang_e::DE, tokens ) == "Hallo John!!"
+                && found.size() == 1 && found[0].id == 2;
+
+        // the name is still taken by template 2, the previous state is kept
+
+        write_catalog( filename, {
+            "T;1;1;Goodbye;",
+            "L;1;en;Greeting;Hello $NAME.",
+            "L;1;de;Begrüßung;Hallo $NAME!!",
+            "T;2;1;Goodbye;",
+            "L;2;en;Farewell;Bye $NAME." } );
+
+        is_ok = is_ok && reload_throws( ttk )
+                && ttk.find_template_id_by_name( "Greeting" ) == 1
+                && ttk.find_template_id_by_name( "Goodbye" ) == 2;
+
+        // an invalid line rejects the valid changes too
+
+        auto before = to_string( ttk );
+
+        write_catalog( filename, {
+            "T;1;1;Greeting;",
+            "L;1;en;Greeting;Hello $NAME, how are you?",
+            "L;1;de;Begrüßung;Hallo $NAME!!",
+            "T;2;1;Goodbye;",
+            "L;2;en;Farewell;Bye $NAME.",
+            "L;2;ru;Missing body" } );
+
+        is_ok = is_ok && reload_throws( ttk ) && to_string( ttk ) == before;
+
+        // a localized template without its general one
+
+        write_catalog( filename, {
+            "T;1;1;Greeting;",
+            "L;1;en;Greeting;Hello $NAME, how are you?",
+            "L;1;de;Begrüßung;Hallo $NAME!!",
+            "L;2;en;Farewell;Bye $NAME." } );
+
+        is_ok = is_ok && reload_throws( ttk ) && to_string( ttk ) == before;
+
+        // the fixed file is loaded
+
+        write_catalog( filename, {
+            "T;1;1;Greeting;",
+            "L;1;en;Greeting;Hello $NAME, how are you?",
+            "L;1;de;Begrüßung;Hallo $NAME!!" } );
+
+        is_ok = is_ok && ttk.reload()
+                && ttk.format( 1, lang_tools::lang_e::EN, tokens ) == "Hello John, how are you?"
+                && ttk.has_template( 2, lang_tools::lang_e::EN ) == false;
+
+        if( is_ok )
+            std::cout << "OK: removal, rename and rejected reloads, compressed " << is_compressed << std::endl;
+        else
+            std::cout << "ERROR: unexpected state after reload, compressed " << is_compressed << "\n" << to_string( ttk ) << std::endl;
+    }
+
+    std::remove( filename.c_str() );
+}
+
+void test_24_reload_blocks()
+{
+    std::cout << "TEST 24" << std::endl;
+
+    // the catalog spans many blocks, the reloaded keeper must match a freshly loaded one
+
+    const std::string filename  = "example_reload.csv";
+    const unsigned num_templs   = 3000;
+
+    std::vector<std::string> lines;
+
+    for( unsigned i = 1; i <= num_templs; ++i )
+    {
+        auto id = std::to_string( i );
+
+        lines.push_back( "T;" + id + ";" + std::to_string( i % 7 + 1 ) + ";Templ" + id + ";" );
+        lines.push_back( "L;" + id + ";en;Template " + id + ";Dear $NAME, this is template " + id + "." );
+        lines.push_back( "L;" + id + ";de;Vorlage " + id + ";Sehr geehrte(r) $NAME, das ist Vorlage " + id + "." );
+    }
+
+    bool is_ok = true;
+
+    for( auto is_compressed : { false, true } )
+    {
+        write_catalog( filename, lines );
+
+        templtextkeeper::TemplTextKeeper ttk;
+
+        ttk.init( filename, is_compressed );
+
+        ttk.search_templates( "Template", 0, lang_tools::lang_e::UNDEF );
+
+        auto changed = lines;
+
+        changed[ 3 * 10 + 2 ]   = "L;11;de;Vorlage 11;Hallo $NAME, das ist $TEXT.";     // body and placeholders
+        changed[ 3 * 500 ]      = "T;501;3;Renamed501;";
+        changed[ 3 * 700 + 1 ]  = "# L;701;en was removed";
+        changed.erase( changed.begin() + 3 * 1200, changed.begin() + 3 * 1201 );       // template 1201 removed
+        changed.push_back( changed[ 3 * 900 + 1 ] );                                   // record moved to another block
+        changed.erase( changed.begin() + 3 * 900 + 1 );
+        changed.push_back( "T;5000;1;Templ1201;" );                                    // its name taken over
+        changed.push_back( "L;5000;en;New;Hello $NAME, $UNKNOWN." );
+        changed.insert( changed.begin() + 4000, "" );
+
+        write_catalog( filename, changed );
+
+        bool is_reloaded = ttk.reload();
+
+        templtextkeeper::TemplTextKeeper fresh;
+
+        fresh.init( filename, is_compressed );
+
+        auto found  = ttk.search_templates( "Renamed501", 0, lang_tools::lang_e::UNDEF );
+
+        // equally ranked results are cut at max_results the same way
+
+        for( auto & q : { "Template", "Vorlage", "Templ", "Tempalte", "Template 1", "Sehr 11" } )
+        {
+            for( auto locale : { lang_tools::lang_e::UNDEF, lang_tools::lang_e::DE } )
+            {
+                for( templtextkeeper::category_id_t category_id : { 0, 3 } )
+                {
+                    auto a = ttk.search_templates( q, category_id, locale, 20 );
+                    auto b = fresh.search_templates( q, category_id, locale, 20 );
+
+                    is_ok = is_ok && a.size() == b.size();
+
+                    for( size_t i = 0; is_ok && i < a.size(); ++i )
+                        is_ok = a[i].id == b[i].id && a[i].locale == b[i].locale;
+                }
+            }
+        }
+
+        is_ok = is_ok && is_reloaded && to_string( ttk ) == to_string( fresh )
+                && found.size() == 2 && found[0].id == 501
+                && ttk.search_templates( "Templ1201", 0, lang_tools::lang_e::UNDEF ).at( 0 ).id == 5000;
+
+        // a duplicate far from the original, in a block of its own
+
+        auto duplicate = changed;
+
+        duplicate.push_back( "L;11;de;Vorlage 11;Duplicate" );
+
+        write_catalog( filename, duplicate );
+
+        is_ok = is_ok && reload_throws( ttk ) && to_string( ttk ) == to_string( fresh );
+    }
+
+    std::remove( filename.c_str() );
+
+    if( is_ok )
+        std::cout << "OK: reloaded catalog matches the freshly loaded one" << std::endl;
+    else
+        std::cout << "ERROR: reloaded catalog differs from the freshly loaded one" << std::endl;
+}
+
+void generate_catalog( const std::string & filename, unsigned num_templs, unsigned changed_id = 0 )
+{
+    std::ofstream os( filename );
+
+    for( unsigned i = 1; i <= num_templs; ++i )
+    {
+        os << "T;" << i << ";" << ( i % 50 + 1 ) << ";Templ" << i << "\n";
+    }
+
+    for( unsigned i = 1; i <= num_templs; ++i )
+    {
+        os << "L;" << i << ";en;Order notification " << i << ";Dear $SALUTATION $NAME, thank you for your order #$ORDER_" << i % 7
+                << " placed on $DATE. Your parcel will be shipped within " << i % 5 + 1 << " business days. Kind regards, Customer Service Team"
+                << ( i == changed_id ? " (changed)" : "" ) << "\n";
+        os << "L;" << i << ";de;Bestellbenachrichtigung " << i << ";Sehr geehrte(r) $SALUTATION $NAME, vielen Dank für Ihre Bestellung #$ORDER_" << i % 7
+                << " vom $DATE. Ihr Paket wird innerhalb von " << i % 5 + 1 << " Werktagen versandt. Mit freundlichen Grüßen, Ihr Kundenservice\n";
+        os << "L;" << i << ";ru;Уведомление о заказе " << i << ";Уважаемый(ая) $SALUTATION $NAME, спасибо за заказ #$ORDER_" << i % 7
+                << " от $DATE. Посылка будет отправлена в течение " << i % 5 + 1 << " рабочих дней. С уважением, служба поддержки\n";
+    }
+}
+
+double elapsed_ns( const std::chrono::steady_clock::time_point & start, unsigned num )
+{
+    return std::chrono::duration<double, std::nano>( std::chrono::steady_clock::now() - start ).count() / num;
+}
+
+void bench_01_compression()
+{
+    std::cout << "BENCH 01: compressed bodies" << std::endl;
+
+    const unsigned num_templs = 10000;
+
+    const std::vector<lang_tools::lang_e> langs = { lang_tools::lang_e::EN, lang_tools::lang_e::DE, lang_tools::lang_e::RU };
+
+    generate_catalog( "bench_templates.csv", num_templs );
+
+    for( auto is_compressed : { false, true } )
+    {
+        templtextkeeper::TemplTextKeeper ttk;
+
+        auto start = std::chrono::steady_clock::now();
+
+        ttk.init( "bench_templates.csv", is_compressed );
+
+        std::cout << ( is_compressed ? "compressed" : "plain" ) << ": init " << elapsed_ns( start, 1 ) / 1000000 << " ms" << std::endl;
+
+        if( is_compressed )
+        {
+            auto stats = ttk.get_compression_stats();
+
+            std::cout << "raw size " << stats.raw_size << ", packed size " << stats.packed_size << ", dictionary size " << stats.dict_size
+                    << ", ratio " << double( stats.raw_size ) / ( stats.packed_size + stats.dict_size ) << std::endl;
+        }
+
+        for( auto pass : { "first use", "cached" } )
+        {
+            start = std::chrono::steady_clock::now();
+
+            for( unsigned i = 1; i <= num_templs; ++i )
+            {
+                for( auto l : langs )
+                {
+                    if( ttk.get_template( i, l ) == nullptr )
+                        std::cout << "ERROR: cannot find template " << i << std::endl;
+                }
+            }
+
+            std::cout << pass << ": get_template " << elapsed_ns( start, num_templs * langs.size() ) << " ns" << std::endl;
+        }
+    }
+}
+
+void bench_02_search()
+{
+    std::cout << "BENCH 02: search" << std::endl;
+
+    const unsigned num_templs = 170000;     // ~500k localized entries
+
+    generate_catalog( "bench_templates.csv", num_templs );
+
+    templtextkeeper::TemplTextKeeper ttk;
+
+    ttk.init( "bench_templates.csv" );
+
+    auto start = std::chrono::steady_clock::now();
+
+    ttk.search_templates( "order", 0, lang_tools::lang_e::UNDEF, 10 );
+
+    std::cout << "first search, builds the index: " << elapsed_ns( start, 1 ) / 1000000 << " ms" << std::endl;
+
+    const std::vector<std::string> queries = { "notifcation 12345", "Bestelbenachrichtigung 777", "уведомление", "ord", "xyz" };
+
+    const unsigned num_iter = 100;
+
+    for( auto & q : queries )
+    {
+        templtextkeeper::TemplTextKeeper::Records info;
+
+        start = std::chrono::steady_clock::now();
+
+        for( unsigned i = 0; i < num_iter; ++i )
+            info = ttk.search_templates( q, 0, lang_tools::lang_e::UNDEF, 10 );
+
+        std::cout << "'" << q << "': " << elapsed_ns( start, num_iter ) / 1000 << " us, "
+                << info.size() << " results, best '" << ( info.empty() ? "" : info.front().localized_name ) << "'" << std::endl;
+    }
+}
+
+void bench_03_hot_templates()
+{
+    std::cout << "BENCH 03: lookup and format under Zipfian access" << std::endl;
+
+    const unsigned num_templs   = 10000;
+    const unsigned num_accesses = 1000000;
+
+    const std::vector<lang_tools::lang_e> langs = { lang_tools::lang_e::EN, lang_tools::lang_e::DE, lang_tools::lang_e::RU };
+
+    generate_catalog( "bench_templates.csv", num_templs );
+
+    std::vector<std::pair<uint32_t, lang_tools::lang_e>> keys;
+
+    for( unsigned i = 1; i <= num_templs; ++i )
+        for( auto l : langs )
+            keys.push_back( std::make_pair( i, l ) );
+
+    std::mt19937 gen( 1 );
+
+    std::shuffle( keys.begin(), keys.end(), gen );
+
+    std::vector<double> weights;
+
+    for( unsigned i = 0; i < keys.size(); ++i )
+        weights.push_back( 1.0 / std::pow( i + 1, 1.1 ) );
+
+    std::discrete_distribution<unsigned> zipf( weights.begin(), weights.end() );
+
+    std::vector<unsigned> accesses;
+
+    for( unsigned i = 0; i < num_accesses; ++i )
+        accesses.push_back( zipf( gen ) );
+
+    auto run = [&]( const templtextkeeper::TemplTextKeeper & ttk, const std::string & title )
+    {
+        templtextkeeper::TemplTextKeeper::Args args( ttk.get_slot_count(), "value" );
+
+        size_t total = 0;
+
+        auto start = std::chrono::steady_clock::now();
+
+        for( auto a : accesses )
+            total += ttk.format( keys[a].first, keys[a].second, args ).size();
+
+        std::cout << title << ": " << elapsed_ns( start, num_accesses ) << " ns per lookup and format (" << total << " bytes)" << std::endl;
+    };
+
+    {
+        templtextkeeper::TemplTextKeeper ttk;
+
+        ttk.init( "bench_templates.csv" );
+
+        run( ttk, "without profile" );
+
+        ttk.set_access_sampling( 16 );
+
+        run( ttk, "sampling" );
+
+        ttk.save_profile( "bench_profile.csv" );
+    }
+
+    {
+        templtextkeeper::TemplTextKeeper ttk;
+
+        ttk.load_profile( "bench_profile.csv" );
+        ttk.init( "bench_templates.csv" );
+
+        run( ttk, "with profile" );
+    }
+}
+
+void bench_04_reload()
+{
+    std::cout << "BENCH 04: reload" << std::endl;
+
+    const unsigned num_templs = 170000;
+
+    generate_catalog( "bench_templates.csv", num_templs );
+
+    templtextkeeper::TemplTextKeeper ttk;
+
+    auto start = std::chrono::steady_clock::now();
+
+    ttk.init( "bench_templates.csv" );
+
+    std::cout << "init " << elapsed_ns( start, 1 ) / 1000000 << " ms" << std::endl;
+
+    start = std::chrono::steady_clock::now();
+
+    auto b = ttk.reload();
+
+    std::cout << "unchanged file: reload " << b << ", " << elapsed_ns( start, 1 ) / 1000 << " us" << std::endl;
+
+    generate_catalog( "bench_templates.csv", num_templs, 12345 );
+
+    start = std::chrono::steady_clock::now();
+
+    b = ttk.reload();
+
+    std::cout << "one line changed: reload " << b << ", " << elapsed_ns( start, 1 ) / 1000000 << " ms" << std::endl;
+
+    std::cout << "changed template: " << ttk.get_template( 12345, lang_tools::lang_e::EN )->get_template() << std::endl;
+}
+
+void bench_05_validation()
+{
+    std::cout << "BENCH 05: validation" << std::endl;
+
+    const unsigned num_templs = 170000;
+
+    generate_catalog( "bench_templates.csv", num_templs );
+
+    templtextkeeper::TemplTextKeeper ttk;
+
+    auto start = std::chrono::steady_clock::now();
+
+    ttk.init( "bench_templates.csv" );
+
+    std::cout << "init with validation " << elapsed_ns( start, 1 ) / 1000000 << " ms, issues " << ttk.get_issues().size() << std::endl;
+
+    templtextkeeper::TemplTextKeeper::Args args( ttk.get_slot_count(), "some argument" );
+
+    const unsigned num_iter = 1000000;
+
+    size_t total = 0;
+
+    start = std::chrono::steady_clock::now();
+
+    for( unsigned i = 0; i < num_iter; ++i )
+        total += ttk.format( 1 + i % num_templs, lang_tools::lang_e::EN, args ).size();
+
+    std::cout << "format " << elapsed_ns( start, num_iter ) << " ns/op, " << total << " bytes" << std::endl;
+}
+
+void bench_06_shared_memory()
+{
+    std::cout << "BENCH 06: shared memory" << std::endl;
+
+    const unsigned num_templs = 170000;
+
+    const std::string shm_name = "/templtextkeeper_bench";
+
+    generate_catalog( "bench_templates.csv", num_templs );
+
+    templtextkeeper::TemplTextKeeper ttk;
+
+    auto start = std::chrono::steady_clock::now();
+
+    ttk.init( "bench_templates.csv" );
+
+    std::cout << "init " << elapsed_ns( start, 1 ) / 1000000 << " ms" << std::endl;
+
+    start = std::chrono::steady_clock::now();
+
+    templtextkeeper::ShmTemplTextKeeper::publish( shm_name, ttk );
+
+    std::cout << "publish " << elapsed_ns( start, 1 ) / 1000000 << " ms" << std::endl;
+
+    templtextkeeper::ShmTemplTextKeeper shm;
+
+    start = std::chrono::steady_clock::now();
+
+    shm.attach( shm_name );
+
+    std::cout << "attach " << elapsed_ns( start, 1 ) / 1000 << " us" << std::endl;
+
+    for( auto pass : { "first use", "cached" } )
+    {
+        start = std::chrono::steady_clock::now();
+
+        for( unsigned i = 1; i <= num_templs; ++i )
+        {
+            if( shm.get_template( i, lang_tools::lang_e::DE ) == nullptr )
+                std::cout << "ERROR: cannot find template " << i << std::endl;
+        }
+
+        std::cout << pass << ": get_template " << elapsed_ns( start, num_templs ) << " ns" << std::endl;
+    }
+
+    templtextkeeper::ShmTemplTextKeeper::remove( shm_name );
+}
+
+int main( int argc, char ** argv )
 {
     templtextkeeper::TemplTextKeeper ttk;
 
@@ -302,6 +1364,35 @@ int main()
     test_12_find_templates( ttk );
     test_13_find_templates( ttk );
     test_14_find_templates( ttk );
+    test_15_format_slots( ttk );
+    test_15_b_parsers();
+    test_16_format_names( ttk );
+    test_16_b_format_names( ttk );
+    test_17_search_templates( ttk );
+    test_18_search_templates( ttk );
+    test_19_issues();
+    test_19_b_issues();
+    test_20_shared_memory( ttk );
+    test_20_b_shared_memory_names();
+    test_21_compressed_bodies();
+    test_22_profile();
+    test_22_b_profile_concurrent_lookups();
+    test_23_reload();
+    test_24_reload_blocks();
+
+    // benchmarks generate large catalogs in the working directory, so they run on demand only
+    if( argc > 1 && std::string( argv[1] ) == "--bench" )
+    {
+        bench_01_compression();
+        bench_02_search();
+        bench_03_hot_templates();
+        bench_04_reload();
+        bench_05_validation();
+        bench_06_shared_memory();
+
+        std::remove( "bench_templates.csv" );
+        std::remove( "bench_profile.csv" );
+    }
 
     return 0;
 }
@@ -0,0 +1,49 @@
+/*
+
+Text Template Keeper library - Linter.
+
+Copyright (C) 2015 Sergey Kolevatov
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// $Revision: 8742 $ $Date:: 2018-03-12 #$ $Author: serge $
+
+#include "linter.h"                     // self
+
+NAMESPACE_TEMPLTEXTKEEPER_START
+
+Linter::Linter( const std::set<std::string> & known_functions ):
+        known_functions_( known_functions )
+{
+}
+
+Linter::Errors Linter::check( const SlotTempl & st ) const
+{
+    Errors res = st.get_errors();
+
+    if( known_functions_.empty() )
+        return res;
+
+    for( auto & f : st.get_functions() )
+    {
+        if( known_functions_.count( f.name ) == 0 )
+            res.push_back( "unknown function '" + f.name + "' at position " + std::to_string( f.pos ) );
+    }
+
+    return res;
+}
+
+NAMESPACE_TEMPLTEXTKEEPER_END
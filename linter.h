@@ -0,0 +1,67 @@
+/*
+
+Text Template Keeper library - Linter.
+
+Copyright (C) 2015 Sergey Kolevatov
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// $Revision: 8742 $ $Date:: 2018-03-12 #$ $Author: serge $
+
+#ifndef LIB_TEMPLTEXTKEEPER_LINTER_H
+#define LIB_TEMPLTEXTKEEPER_LINTER_H
+
+#include <string>                   // std::string
+#include <vector>                   // std::vector
+#include <set>                      // std::set
+
+#include "slot_templ.h"             // SlotTempl
+
+NAMESPACE_TEMPLTEXTKEEPER_START
+
+/**
+ * @brief Checks of a compiled template.
+ *
+ * Works on the segments, slots and function calls recognized by SlotTempl, so templates
+ * are not parsed a second time. Stateless after construction, so one instance can be
+ * shared by several threads.
+ */
+class Linter
+{
+public:
+
+    typedef SlotTempl::Errors   Errors;
+
+public:
+
+    /**
+     * @param known_functions   functions the templates may call, if empty function names are not checked
+     */
+    explicit Linter( const std::set<std::string> & known_functions );
+
+    /**
+     * @brief returns the syntax errors of the template and its calls of unknown functions
+     */
+    Errors check( const SlotTempl & st ) const;
+
+private:
+
+    std::set<std::string>   known_functions_;
+};
+
+NAMESPACE_TEMPLTEXTKEEPER_END
+
+#endif // LIB_TEMPLTEXTKEEPER_LINTER_H
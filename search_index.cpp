@@ -0,0 +1,773 @@
+/*
+
+Text Template Keeper library - Search Index.
+
+Copyright (C) 2015 Sergey Kolevatov
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// $Revision: 8742 $ $Date:: 2018-03-12 #$ $Author: serge $
+
+#include "search_index.h"               // self
+
+#include <algorithm>                    // std::sort
+#include <queue>                        // std::priority_queue
+#include <functional>                   // std::greater
+#include <limits>                       // std::numeric_limits
+
+NAMESPACE_TEMPLTEXTKEEPER_START
+
+const uint32_t SearchIndex::MAX_PREFIX_EXPANSIONS;
+const uint32_t SearchIndex::MIN_REMOVED_TO_COMPACT;
+const uint32_t SearchIndex::NO_INDEX;
+
+namespace
+{
+const uint32_t SCORE_EXACT          = 100;
+const uint32_t SCORE_PREFIX         = 70;
+const uint32_t SCORE_FUZZY          = 60;
+const uint32_t PENALTY_PER_EDIT     = 20;
+const uint32_t BONUS_FIRST_WORD     = 10;
+}
+
+SearchIndex::SearchIndex():
+        num_removed_( 0 ),
+        is_finalized_( false )
+{
+}
+
+void SearchIndex::clear()
+{
+    entries_.clear();
+    is_removed_.clear();
+    num_removed_    = 0;
+    entry_indices_.clear();
+    is_finalized_   = false;
+    words_.clear();
+    word_ids_.clear();
+    first_postings_.clear();
+    other_postings_.clear();
+    trigram_words_.clear();
+    sorted_words_.clear();
+}
+
+void SearchIndex::add( const Entry & e, const std::string & name, const std::string & localized_name )
+{
+    // a newer version of the entry replaces the older one
+    remove( e.id, e.locale );
+
+    uint32_t entry_idx = entries_.size();
+
+    entries_.push_back( e );
+    is_removed_.push_back( false );
+
+    entry_indices_[ to_key( e.id, e.locale ) ] = entry_idx;
+
+    add_words( entry_idx, name );
+    add_words( entry_idx, localized_name );
+}
+
+void SearchIndex::remove( id_t id, lang_tools::lang_e locale )
+{
+    auto it = entry_indices_.find( to_key( id, locale ) );
+
+    if( it == entry_indices_.end() )
+        return;
+
+    is_removed_[ it->second ] = true;
+
+    entry_indices_.erase( it );
+
+    ++num_removed_;
+
+    if( num_removed_ >= MIN_REMOVED_TO_COMPACT && num_removed_ * 4 >= entries_.size() )
+        compact();
+}
+
+void SearchIndex::compact()
+{
+    // entries keep their relative order, so the postings stay sorted
+
+    std::vector<uint32_t> new_indices( entries_.size(), NO_INDEX );
+
+    Entries entries;
+
+    entries.reserve( entries_.size() - num_removed_ );
+
+    for( uint32_t i = 0; i < entries_.size(); ++i )
+    {
+        if( is_removed_[i] )
+            continue;
+
+        new_indices[i] = entries.size();
+
+        entries.push_back( entries_[i] );
+    }
+
+    for( auto & e : entry_indices_ )
+        e.second = new_indices[ e.second ];
+
+    auto remap = [&]( Postings & postings )
+    {
+        size_t size = 0;
+
+        for( auto idx : postings )
+        {
+            if( new_indices[ idx ] != NO_INDEX )
+                postings[ size++ ] = new_indices[ idx ];
+        }
+
+        postings.resize( size );
+        postings.shrink_to_fit();
+    };
+
+    // words left without postings are dropped
+
+    std::vector<uint32_t> new_word_ids( words_.size(), NO_INDEX );
+
+    Words                   words;
+    std::vector<Postings>   first_postings;
+    std::vector<Postings>   other_postings;
+
+    word_ids_.clear();
+    trigram_words_.clear();
+
+    for( uint32_t i = 0; i < words_.size(); ++i )
+    {
+        remap( first_postings_[i] );
+        remap( other_postings_[i] );
+
+        if( first_postings_[i].empty() && other_postings_[i].empty() )
+            continue;
+
+        uint32_t word_id = words.size();
+
+        new_word_ids[i] = word_id;
+
+        words.push_back( std::move( words_[i] ) );
+        first_postings.push_back( std::move( first_postings_[i] ) );
+        other_postings.push_back( std::move( other_postings_[i] ) );
+
+        word_ids_[ words.back() ] = word_id;
+
+        for( auto g : trigrams( words.back() ) )
+            trigram_words_[ g ].push_back( word_id );
+    }
+
+    std::vector<uint32_t> sorted_words;
+
+    for( auto word_id : sorted_words_ )
+    {
+        if( new_word_ids[ word_id ] != NO_INDEX )
+            sorted_words.push_back( new_word_ids[ word_id ] );
+    }
+
+    entries_.swap( entries );
+    words_.swap( words );
+    first_postings_.swap( first_postings );
+    other_postings_.swap( other_postings );
+    sorted_words_.swap( sorted_words );
+
+    is_removed_.assign( entries_.size(), false );
+
+    num_removed_    = 0;
+}
+
+void SearchIndex::finalize()
+{
+    sorted_words_.resize( words_.size() );
+
+    for( uint32_t i = 0; i < words_.size(); ++i )
+        sorted_words_[i] = i;
+
+    std::sort( sorted_words_.begin(), sorted_words_.end(),
+            [this]( uint32_t a, uint32_t b ) { return words_[a] < words_[b]; } );
+
+    is_finalized_   = true;
+}
+
+SearchIndex::Entries SearchIndex::search(
+        const std::string   & query,
+        category_id_t       category_id,
+        lang_tools::lang_e  locale,
+        uint32_t            max_results,
+        uint32_t            max_distance ) const
+{
+    // rank key: number of matched query words in the upper half, score in the lower half
+
+    auto terms = split( query );
+
+    if( terms.empty() || max_results == 0 )
+        return Entries();
+
+    std::vector<Sources> term_sources;
+
+    uint64_t max_score      = 0;
+    size_t   pivot          = 0;
+    uint64_t pivot_size     = std::numeric_limits<uint64_t>::max();
+
+    for( auto & term : terms )
+    {
+        auto sources = get_sources( term, max_distance );
+
+        // words matching nothing don't affect the ranking
+        if( sources.empty() )
+            continue;
+
+        term_sources.push_back( sources );
+
+        uint64_t size = 0;
+
+        for( auto & src : sources )
+            size += src.postings->size();
+
+        max_score += sources.front().score;
+
+        if( size < pivot_size )
+        {
+            pivot       = term_sources.size() - 1;
+            pivot_size  = size;
+        }
+    }
+
+    if( term_sources.empty() )
+        return Entries();
+
+    uint64_t max_key = ( uint64_t( term_sources.size() ) << 32 ) | max_score;
+
+    // keep the best max_results in a heap, the worst of them on top;
+    // ties are broken by (id, locale), entry indices change on reload
+
+    typedef std::pair<uint64_t, uint32_t> KeyToIndex;
+
+    auto tie_key = [this]( uint32_t entry_idx )
+    {
+        return to_key( entries_[ entry_idx ].id, entries_[ entry_idx ].locale );
+    };
+
+    auto is_better = [&tie_key]( const KeyToIndex & a, const KeyToIndex & b )
+    {
+        return a.first > b.first || ( a.first == b.first && tie_key( a.second ) < tie_key( b.second ) );
+    };
+
+    typedef std::priority_queue<KeyToIndex, std::vector<KeyToIndex>, decltype( is_better )> TopResults;
+
+    TopResults top( is_better );
+
+    auto offer = [&]( const KeyToIndex & k )
+    {
+        if( top.size() < max_results )
+        {
+            top.push( k );
+        }
+        else if( is_better( k, top.top() ) )
+        {
+            top.pop();
+            top.push( k );
+        }
+    };
+
+    // walk the entries containing the most selective word in index order;
+    // entries without it can't match all words, and once max_results entries reached
+    // the best possible key only a later entry with a lower (id, locale) can outrank them
+
+    typedef std::pair<uint32_t, uint32_t> IndexToSource;    // current entry index --> source
+
+    std::priority_queue<IndexToSource, std::vector<IndexToSource>, std::greater<IndexToSource>> cursors;
+
+    std::vector<uint32_t> positions( term_sources[ pivot ].size(), 0 );
+
+    for( uint32_t i = 0; i < term_sources[ pivot ].size(); ++i )
+        cursors.push( IndexToSource( term_sources[ pivot ][i].postings->front(), i ) );
+
+    bool     is_complete    = false;
+    uint32_t num_full       = 0;
+    uint32_t last_idx       = std::numeric_limits<uint32_t>::max();
+
+    while( cursors.empty() == false )
+    {
+        auto c = cursors.top();
+        cursors.pop();
+
+        auto & postings = * term_sources[ pivot ][ c.second ].postings;
+
+        if( ++positions[ c.second ] < postings.size() )
+            cursors.push( IndexToSource( postings[ positions[ c.second ] ], c.second ) );
+
+        if( c.first == last_idx )
+            continue;
+
+        last_idx = c.first;
+
+        if( is_complete && tie_key( c.first ) > tie_key( top.top().second ) )
+            continue;
+
+        if( is_match( c.first, category_id, locale ) == false )
+            continue;
+
+        auto key = evaluate( c.first, term_sources );
+
+        if( ( key >> 32 ) == term_sources.size() )
+            ++num_full;
+
+        offer( KeyToIndex( key, c.first ) );
+
+        if( top.size() == max_results && top.top().first == max_key )
+            is_complete = true;
+    }
+
+    if( is_complete == false && num_full < max_results && term_sources.size() > 1 )
+    {
+        // too few entries match all the words, rank the partial matches exhaustively
+
+        std::unordered_map<uint32_t, uint64_t> keys;   // entry index --> rank key
+
+        for( auto & sources : term_sources )
+        {
+            MapIndexToScore entry_scores;
+
+            for( auto & src : sources )
+            {
+                for( auto idx : * src.postings )
+                {
+                    if( is_match( idx, category_id, locale ) == false )
+                        continue;
+
+                    auto & best = entry_scores[ idx ];
+
+                    if( src.score > best )
+                        best = src.score;
+                }
+            }
+
+            for( auto & es : entry_scores )
+                keys[ es.first ] += ( uint64_t( 1 ) << 32 ) | es.second;
+        }
+
+        while( top.empty() == false )
+            top.pop();
+
+        for( auto & k : keys )
+            offer( KeyToIndex( k.second, k.first ) );
+    }
+
+    Entries res( top.size() );
+
+    for( auto i = res.size(); i > 0; --i )
+    {
+        res[i - 1] = entries_[ top.top().second ];
+        top.pop();
+    }
+
+    return res;
+}
+
+SearchIndex::Sources SearchIndex::get_sources( const Word & w, uint32_t max_distance ) const
+{
+    MapIndexToScore word_scores;
+
+    match_word( w, max_distance, word_scores );
+
+    Sources res;
+
+    for( auto & ws : word_scores )
+    {
+        Source src;
+
+        src.postings    = & first_postings_[ ws.first ];
+        src.score       = ws.second + BONUS_FIRST_WORD;
+
+        if( src.postings->empty() == false )
+            res.push_back( src );
+
+        src.postings    = & other_postings_[ ws.first ];
+        src.score       = ws.second;
+
+        if( src.postings->empty() == false )
+            res.push_back( src );
+    }
+
+    std::sort( res.begin(), res.end(), []( const Source & a, const Source & b ) { return a.score > b.score; } );
+
+    return res;
+}
+
+bool SearchIndex::is_match( uint32_t entry_idx, category_id_t category_id, lang_tools::lang_e locale ) const
+{
+    if( is_removed_[ entry_idx ] )
+        return false;
+
+    auto & e = entries_[ entry_idx ];
+
+    if( category_id != 0 && category_id != e.category_id )
+        return false;
+
+    if( locale != lang_tools::lang_e::UNDEF && locale != e.locale )
+        return false;
+
+    return true;
+}
+
+uint64_t SearchIndex::evaluate( uint32_t entry_idx, const std::vector<Sources> & term_sources )
+{
+    uint64_t res = 0;
+
+    for( auto & sources : term_sources )
+    {
+        // sources are sorted by score, so the first hit is the best one
+        for( auto & src : sources )
+        {
+            if( std::binary_search( src.postings->begin(), src.postings->end(), entry_idx ) )
+            {
+                res += ( uint64_t( 1 ) << 32 ) | src.score;
+                break;
+            }
+        }
+    }
+
+    return res;
+}
+
+void SearchIndex::match_word( const Word & w, uint32_t max_distance, MapIndexToScore & word_scores ) const
+{
+    auto it = word_ids_.find( w );
+
+    if( it != word_ids_.end() )
+        word_scores[ it->second ] = SCORE_EXACT;
+
+    // prefix
+
+    if( w.size() >= 2 )
+    {
+        auto it_p = std::lower_bound( sorted_words_.begin(), sorted_words_.end(), w,
+                [this]( uint32_t a, const Word & b ) { return words_[a] < b; } );
+
+        for( uint32_t n = 0; it_p != sorted_words_.end() && n < MAX_PREFIX_EXPANSIONS; ++it_p, ++n )
+        {
+            auto & word = words_[ * it_p ];
+
+            if( word.compare( 0, w.size(), w ) != 0 )
+                break;
+
+            if( word.size() == w.size() )
+                continue;
+
+            uint32_t score = SCORE_PREFIX + ( SCORE_EXACT - SCORE_PREFIX ) * w.size() / word.size();
+
+            auto & s = word_scores[ * it_p ];
+
+            if( score > s )
+                s = score;
+        }
+    }
+
+    // fuzzy
+
+    auto distance = allowed_distance( w, max_distance );
+
+    if( distance == 0 )
+        return;
+
+    // a typo in a number makes another valid number, and numbers share most of their trigrams
+    if( std::all_of( w.begin(), w.end(), []( uint32_t c ) { return c >= '0' && c <= '9'; } ) )
+        return;
+
+    // words within the distance d share at least |w| + 2 - 3d padded trigrams, so each of them
+    // is in one of the |trigrams| - min_common + 1 shortest trigram lists
+
+    auto grams = trigrams( w );
+
+    uint32_t min_common = w.size() + 2 - 3 * distance;
+
+    std::vector<const std::vector<uint32_t> *> lists;
+
+    for( auto g : grams )
+    {
+        auto it_g = trigram_words_.find( g );
+
+        if( it_g != trigram_words_.end() )
+            lists.push_back( & it_g->second );
+    }
+
+    if( lists.size() < min_common )
+        return;
+
+    std::sort( lists.begin(), lists.end(),
+            []( const std::vector<uint32_t> * a, const std::vector<uint32_t> * b ) { return a->size() < b->size(); } );
+
+    lists.resize( grams.size() - min_common + 1 < lists.size() ? grams.size() - min_common + 1 : lists.size() );
+
+    std::vector<uint32_t> candidates;
+
+    for( auto l : lists )
+    {
+        for( auto word_id : * l )
+        {
+            auto size = words_[ word_id ].size();
+
+            if( size + distance < w.size() || size > w.size() + distance )
+                continue;
+
+            candidates.push_back( word_id );
+        }
+    }
+
+    std::sort( candidates.begin(), candidates.end() );
+    candidates.erase( std::unique( candidates.begin(), candidates.end() ), candidates.end() );
+
+    std::vector<uint32_t> prev;
+    std::vector<uint32_t> cur;
+
+    for( auto word_id : candidates )
+    {
+        auto d = edit_distance( w, words_[ word_id ], distance, prev, cur );
+
+        if( d == 0 || d > distance )
+            continue;
+
+        uint32_t score = SCORE_FUZZY - PENALTY_PER_EDIT * ( d - 1 );
+
+        auto & s = word_scores[ word_id ];
+
+        if( score > s )
+            s = score;
+    }
+}
+
+void SearchIndex::add_words( uint32_t entry_idx, const std::string & s )
+{
+    auto words = split( s );
+
+    for( uint32_t i = 0; i < words.size(); ++i )
+    {
+        auto word_id = add_word( words[i] );
+
+        auto & postings = ( i == 0 ) ? first_postings_[ word_id ] : other_postings_[ word_id ];
+
+        if( postings.empty() || postings.back() != entry_idx )
+            postings.push_back( entry_idx );
+    }
+}
+
+uint32_t SearchIndex::add_word( const Word & w )
+{
+    uint32_t word_id = words_.size();
+
+    auto b = word_ids_.insert( std::make_pair( w, word_id ) );
+
+    if( b.second == false )
+        return b.first->second;
+
+    words_.push_back( w );
+    first_postings_.push_back( Postings() );
+    other_postings_.push_back( Postings() );
+
+    for( auto g : trigrams( w ) )
+        trigram_words_[ g ].push_back( word_id );
+
+    if( is_finalized_ )
+    {
+        auto it = std::lower_bound( sorted_words_.begin(), sorted_words_.end(), w,
+                [this]( uint32_t a, const Word & b ) { return words_[a] < b; } );
+
+        sorted_words_.insert( it, word_id );
+    }
+
+    return word_id;
+}
+
+uint64_t SearchIndex::to_key( id_t id, lang_tools::lang_e locale )
+{
+    return ( uint64_t( id ) << 32 ) | static_cast<uint32_t>( locale );
+}
+
+SearchIndex::Words SearchIndex::split( const std::string & s )
+{
+    // decodes UTF-8, invalid sequences act as separators
+
+    Words res;
+
+    Word w;
+
+    size_t i = 0;
+
+    while( i < s.size() )
+    {
+        auto b = static_cast<uint8_t>( s[i] );
+
+        uint32_t c;
+        uint32_t len;
+
+        if( b < 0x80 )
+        {
+            c = b;      len = 1;
+        }
+        else if( ( b & 0xE0 ) == 0xC0 )
+        {
+            c = b & 0x1F; len = 2;
+        }
+        else if( ( b & 0xF0 ) == 0xE0 )
+        {
+            c = b & 0x0F; len = 3;
+        }
+        else if( ( b & 0xF8 ) == 0xF0 )
+        {
+            c = b & 0x07; len = 4;
+        }
+        else
+        {
+            c = 0;      len = 1;
+        }
+
+        if( i + len > s.size() )
+        {
+            c = 0;      len = 1;
+        }
+
+        for( uint32_t k = 1; k < len; ++k )
+        {
+            auto cb = static_cast<uint8_t>( s[i + k] );
+
+            if( ( cb & 0xC0 ) != 0x80 )
+            {
+                c = 0; len = k;
+                break;
+            }
+
+            c = ( c << 6 ) | ( cb & 0x3F );
+        }
+
+        i += len;
+
+        if( is_word_char( c ) )
+        {
+            w.push_back( to_lower( c ) );
+        }
+        else if( w.empty() == false )
+        {
+            res.push_back( w );
+            w.clear();
+        }
+    }
+
+    if( w.empty() == false )
+        res.push_back( w );
+
+    return res;
+}
+
+uint32_t SearchIndex::to_lower( uint32_t c )
+{
+    if( c >= 'A' && c <= 'Z' )
+        return c + 0x20;
+
+    // Latin-1 supplement, except the multiplication sign
+    if( c >= 0xC0 && c <= 0xDE && c != 0xD7 )
+        return c + 0x20;
+
+    // Cyrillic
+    if( c >= 0x410 && c <= 0x42F )
+        return c + 0x20;
+
+    if( c >= 0x400 && c <= 0x40F )
+        return c + 0x50;
+
+    return c;
+}
+
+bool SearchIndex::is_word_char( uint32_t c )
+{
+    if( c < 0x80 )
+        return ( c >= 'A' && c <= 'Z' ) || ( c >= 'a' && c <= 'z' ) || ( c >= '0' && c <= '9' );
+
+    // everything beyond ASCII except Latin-1 punctuation and symbols
+    return c >= 0xC0 && c != 0xD7 && c != 0xF7;
+}
+
+uint64_t SearchIndex::trigram( uint32_t a, uint32_t b, uint32_t c )
+{
+    return ( uint64_t( a ) << 42 ) | ( uint64_t( b ) << 21 ) | c;
+}
+
+std::vector<uint64_t> SearchIndex::trigrams( const Word & w )
+{
+    // the word is padded with two zeros on both sides
+
+    std::vector<uint64_t> res;
+
+    auto at = [&w]( int i ) -> uint32_t
+    {
+        return ( i < 0 || i >= int( w.size() ) ) ? 0 : w[i];
+    };
+
+    for( int i = -2; i < int( w.size() ); ++i )
+        res.push_back( trigram( at( i ), at( i + 1 ), at( i + 2 ) ) );
+
+    std::sort( res.begin(), res.end() );
+    res.erase( std::unique( res.begin(), res.end() ), res.end() );
+
+    return res;
+}
+
+uint32_t SearchIndex::edit_distance( const Word & a, const Word & b, uint32_t max_distance, std::vector<uint32_t> & prev, std::vector<uint32_t> & cur )
+{
+    // Levenshtein distance, returns max_distance + 1 as soon as it is exceeded,
+    // prev and cur are scratch rows to avoid allocations per call
+
+    prev.resize( b.size() + 1 );
+    cur.resize( b.size() + 1 );
+
+    for( uint32_t j = 0; j <= b.size(); ++j )
+        prev[j] = j;
+
+    for( uint32_t i = 1; i <= a.size(); ++i )
+    {
+        cur[0] = i;
+
+        auto row_min = cur[0];
+
+        for( uint32_t j = 1; j <= b.size(); ++j )
+        {
+            auto cost = ( a[i - 1] == b[j - 1] ) ? 0 : 1;
+
+            cur[j] = std::min( std::min( prev[j] + 1, cur[j - 1] + 1 ), prev[j - 1] + cost );
+
+            row_min = std::min( row_min, cur[j] );
+        }
+
+        if( row_min > max_distance )
+            return max_distance + 1;
+
+        std::swap( prev, cur );
+    }
+
+    return prev[ b.size() ];
+}
+
+uint32_t SearchIndex::allowed_distance( const Word & w, uint32_t max_distance )
+{
+    // short words would match almost anything and defeat the trigram filter
+
+    if( w.size() <= 2 )
+        return 0;
+
+    if( w.size() <= 5 )
+        return std::min<uint32_t>( max_distance, 1 );
+
+    return std::min<uint32_t>( max_distance, 2 );
+}
+
+NAMESPACE_TEMPLTEXTKEEPER_END
@@ -0,0 +1,158 @@
+/*
+
+Text Template Keeper library - Search Index.
+
+Copyright (C) 2015 Sergey Kolevatov
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// $Revision: 8742 $ $Date:: 2018-03-12 #$ $Author: serge $
+
+#ifndef LIB_TEMPLTEXTKEEPER_SEARCH_INDEX_H
+#define LIB_TEMPLTEXTKEEPER_SEARCH_INDEX_H
+
+#include <string>                   // std::string
+#include <vector>                   // std::vector
+#include <unordered_map>            // std::unordered_map
+
+#include "lang_tools/language_enum.h"    // lang_tools::lang_e
+
+#include "types.h"                  // id_t
+
+NAMESPACE_TEMPLTEXTKEEPER_START
+
+/**
+ * @brief Typo-tolerant word index over template names.
+ *
+ * Names are split into lower-cased words. A query word matches an indexed word exactly,
+ * as a prefix or within a bounded edit distance; fuzzy candidates are preselected
+ * by common trigrams, so the vocabulary is never scanned as a whole. Numbers are
+ * matched exactly or as a prefix only.
+ */
+class SearchIndex
+{
+public:
+
+    struct Entry
+    {
+        id_t                id;
+        category_id_t       category_id;
+        lang_tools::lang_e  locale;
+    };
+
+    typedef std::vector<Entry> Entries;
+
+public:
+
+    SearchIndex();
+
+    void clear();
+
+    /**
+     * @brief adds an entry, can be called after finalize() as well
+     */
+    void add( const Entry & e, const std::string & name, const std::string & localized_name );
+
+    /**
+     * @brief excludes the entry from the search results
+     *
+     * Removed entries are dropped from the postings once they make up a quarter of the index.
+     */
+    void remove( id_t id, lang_tools::lang_e locale );
+
+    /**
+     * @brief must be called after the initial add() calls and before search()
+     */
+    void finalize();
+
+    /**
+     * @brief returns up to max_results best matching entries, best first
+     *
+     * Entries matching more query words rank higher, then by score:
+     * exact word > prefix > fuzzy (by edit distance), a match on the first word of a name gets a bonus.
+     * Equally ranked entries are ordered by id, then locale.
+     */
+    Entries search(
+            const std::string   & query,
+            category_id_t       category_id,
+            lang_tools::lang_e  locale,
+            uint32_t            max_results,
+            uint32_t            max_distance ) const;
+
+private:
+
+    typedef std::u32string                              Word;
+    typedef std::vector<Word>                           Words;
+    typedef std::vector<uint32_t>                       Postings;   // ascending entry indices
+    typedef std::unordered_map<uint32_t, uint32_t>      MapIndexToScore;
+
+    /**
+     * @brief postings of a matched word, all entries of a source score the same
+     */
+    struct Source
+    {
+        const Postings  * postings;
+        uint32_t        score;
+    };
+
+    typedef std::vector<Source>     Sources;    // sorted by score, best first
+
+    static const uint32_t MAX_PREFIX_EXPANSIONS = 64;
+    static const uint32_t MIN_REMOVED_TO_COMPACT = 1024;
+    static const uint32_t NO_INDEX              = 0xFFFFFFFF;
+
+private:
+
+    static Words split( const std::string & s );
+    static uint32_t to_lower( uint32_t c );
+    static bool is_word_char( uint32_t c );
+    static uint64_t trigram( uint32_t a, uint32_t b, uint32_t c );
+    static std::vector<uint64_t> trigrams( const Word & w );
+    static uint32_t edit_distance( const Word & a, const Word & b, uint32_t max_distance, std::vector<uint32_t> & prev, std::vector<uint32_t> & cur );
+    static uint32_t allowed_distance( const Word & w, uint32_t max_distance );
+
+    void add_words( uint32_t entry_idx, const std::string & s );
+    uint32_t add_word( const Word & w );
+
+    void compact();
+
+    void match_word( const Word & w, uint32_t max_distance, MapIndexToScore & word_scores ) const;
+    Sources get_sources( const Word & w, uint32_t max_distance ) const;
+
+    bool is_match( uint32_t entry_idx, category_id_t category_id, lang_tools::lang_e locale ) const;
+
+    static uint64_t to_key( id_t id, lang_tools::lang_e locale );
+
+    static uint64_t evaluate( uint32_t entry_idx, const std::vector<Sources> & term_sources );
+
+private:
+
+    Entries                                     entries_;
+    std::vector<bool>                           is_removed_;        // entry index --> removed flag
+    uint32_t                                    num_removed_;
+    std::unordered_map<uint64_t, uint32_t>      entry_indices_;     // (id, locale) --> entry index
+    bool                                        is_finalized_;
+    Words                                       words_;             // word id --> word
+    std::unordered_map<Word, uint32_t>          word_ids_;          // word --> word id
+    std::vector<Postings>                       first_postings_;    // word id --> entries whose name starts with the word
+    std::vector<Postings>                       other_postings_;    // word id --> other entries containing the word
+    std::unordered_map<uint64_t, std::vector<uint32_t>> trigram_words_; // trigram --> word ids
+    std::vector<uint32_t>                       sorted_words_;      // word ids in lexicographic order
+};
+
+NAMESPACE_TEMPLTEXTKEEPER_END
+
+#endif // LIB_TEMPLTEXTKEEPER_SEARCH_INDEX_H
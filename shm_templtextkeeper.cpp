@@ -0,0 +1,661 @@
+/*
+
+Text Template Keeper library - Shared Memory Keeper.
+
+Copyright (C) 2015 Sergey Kolevatov
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// $Revision: 8742 $ $Date:: 2018-03-12 #$ $Author: serge $
+
+#include "shm_templtextkeeper.h"        // self
+
+#include "utils/match_filter.h"         // utils::match_filter()
+
+#include <atomic>                       // std::atomic
+#include <cstring>                      // memcpy
+#include <cerrno>                       // errno
+#include <stdexcept>                    // std::runtime_error
+#include <algorithm>                    // std::lower_bound
+#include <map>                          // std::map
+#include <fcntl.h>                      // O_RDONLY
+#include <sys/mman.h>                   // shm_open, mmap
+#include <sys/stat.h>                   // fstat
+#include <unistd.h>                     // ftruncate, close
+
+NAMESPACE_TEMPLTEXTKEEPER_START
+
+// image layout: Header, Template[num_templs] sorted by id, LocalizedTemplate[] grouped by template,
+// Name[num_names] sorted by name, string pool; all references are offsets
+
+struct ShmTemplTextKeeper::Control
+{
+    uint32_t                magic;
+    uint32_t                version;
+    std::atomic<uint64_t>   generation;     // current data segment, 0 - nothing published
+};
+
+struct ShmTemplTextKeeper::Header
+{
+    uint32_t    magic;
+    uint32_t    version;
+    uint64_t    generation;
+    uint64_t    size;
+    uint32_t    num_templs;
+    uint32_t    num_locs;
+    uint32_t    num_names;
+    uint32_t    reserved;
+    uint64_t    templs_offset;
+    uint64_t    locs_offset;
+    uint64_t    names_offset;
+    uint64_t    strings_offset;
+};
+
+struct ShmTemplTextKeeper::String
+{
+    uint32_t    offset;     // in the string pool
+    uint32_t    size;
+};
+
+struct ShmTemplTextKeeper::Template
+{
+    id_t            id;
+    category_id_t   category_id;
+    String          name;
+    uint32_t        first_loc;
+    uint32_t        num_locs;
+};
+
+struct ShmTemplTextKeeper::LocalizedTemplate
+{
+    uint32_t    locale;
+    String      name;
+    String      templ;
+};
+
+struct ShmTemplTextKeeper::Name
+{
+    String      name;
+    id_t        id;
+};
+
+const uint32_t ShmTemplTextKeeper::MAGIC;
+const uint32_t ShmTemplTextKeeper::VERSION;
+
+static_assert( ATOMIC_LLONG_LOCK_FREE == 2, "64-bit atomics must be lock-free to be shared between processes" );
+
+ShmTemplTextKeeper::Mapping::Mapping():
+        addr_( nullptr ),
+        size_( 0 )
+{
+}
+
+ShmTemplTextKeeper::Mapping::~Mapping()
+{
+    unmap();
+}
+
+void ShmTemplTextKeeper::Mapping::map( const std::string & name, bool is_writable, size_t size )
+{
+    unmap();
+
+    int fd = is_writable ? shm_open( name.c_str(), O_RDWR | O_CREAT, 0644 ) : shm_open( name.c_str(), O_RDONLY, 0 );
+
+    if( fd == -1 )
+        throw std::runtime_error( "cannot open shared memory '" + name + "': " + strerror( errno ) );
+
+    struct stat st;
+
+    if( fstat( fd, & st ) != 0 )
+    {
+        close( fd );
+        throw std::runtime_error( "cannot stat shared memory '" + name + "': " + strerror( errno ) );
+    }
+
+    if( is_writable && size_t( st.st_size ) < size )
+    {
+        if( ftruncate( fd, size ) != 0 )
+        {
+            close( fd );
+            throw std::runtime_error( "cannot resize shared memory '" + name + "': " + strerror( errno ) );
+        }
+    }
+    else
+    {
+        size = st.st_size;
+    }
+
+    if( size == 0 )
+    {
+        close( fd );
+        throw std::runtime_error( "shared memory '" + name + "' is empty" );
+    }
+
+    auto addr = mmap( nullptr, size, is_writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0 );
+
+    close( fd );
+
+    if( addr == MAP_FAILED )
+        throw std::runtime_error( "cannot map shared memory '" + name + "': " + strerror( errno ) );
+
+    addr_   = addr;
+    size_   = size;
+}
+
+void ShmTemplTextKeeper::Mapping::unmap()
+{
+    if( addr_ == nullptr )
+        return;
+
+    munmap( addr_, size_ );
+
+    addr_   = nullptr;
+    size_   = 0;
+}
+
+void ShmTemplTextKeeper::Mapping::swap( Mapping & r )
+{
+    std::swap( addr_, r.addr_ );
+    std::swap( size_, r.size_ );
+}
+
+void * ShmTemplTextKeeper::Mapping::get_addr() const
+{
+    return addr_;
+}
+
+size_t ShmTemplTextKeeper::Mapping::get_size() const
+{
+    return size_;
+}
+
+ShmTemplTextKeeper::ShmTemplTextKeeper()
+{
+}
+
+ShmTemplTextKeeper::~ShmTemplTextKeeper()
+{
+    release_templs();
+}
+
+uint64_t ShmTemplTextKeeper::publish( const std::string & shm_name, const TemplTextKeeper & keeper )
+{
+    Mapping control_mapping;
+
+    auto control = open_control( shm_name, control_mapping, true );
+
+    auto prev_generation    = control->generation.load( std::memory_order_acquire );
+    auto generation         = prev_generation + 1;
+
+    auto image = build_image( keeper, generation );
+
+    auto data_name = to_data_name( shm_name, generation );
+
+    // a segment left by a failed publish
+    shm_unlink( data_name.c_str() );
+
+    {
+        Mapping data;
+
+        data.map( data_name, true, image.size() );
+
+        memcpy( data.get_addr(), image.data(), image.size() );
+    }
+
+    control->magic      = MAGIC;
+    control->version    = VERSION;
+    control->generation.store( generation, std::memory_order_release );
+
+    // attached processes keep their mapping of the previous segment
+    if( prev_generation != 0 )
+        shm_unlink( to_data_name( shm_name, prev_generation ).c_str() );
+
+    return generation;
+}
+
+void ShmTemplTextKeeper::remove( const std::string & shm_name )
+{
+    try
+    {
+        Mapping control_mapping;
+
+        auto control = open_control( shm_name, control_mapping, false );
+
+        auto generation = control->generation.load( std::memory_order_acquire );
+
+        if( generation != 0 )
+            shm_unlink( to_data_name( shm_name, generation ).c_str() );
+    }
+    catch( std::exception & )
+    {
+        // nothing published
+    }
+
+    shm_unlink( shm_name.c_str() );
+}
+
+void ShmTemplTextKeeper::attach( const std::string & shm_name )
+{
+    shm_name_   = shm_name;
+
+    open_control( shm_name, control_, false );
+
+    map_current();
+}
+
+bool ShmTemplTextKeeper::refresh()
+{
+    auto control = static_cast<const Control*>( control_.get_addr() );
+
+    if( control == nullptr )
+        throw std::runtime_error( "not attached" );
+
+    if( control->generation.load( std::memory_order_acquire ) == get_generation() )
+        return false;
+
+    map_current();
+
+    return true;
+}
+
+uint64_t ShmTemplTextKeeper::get_generation() const
+{
+    auto header = get_header();
+
+    return header ? header->generation : 0;
+}
+
+std::string ShmTemplTextKeeper::build_image( const TemplTextKeeper & keeper, uint64_t generation )
+{
+    std::vector<Template>           templs;
+    std::vector<LocalizedTemplate>  locs;
+    std::vector<Name>               names;
+    std::string                     pool;
+
+    auto add_string = [&]( const std::string & s ) -> String
+    {
+        if( pool.size() + s.size() > std::numeric_limits<uint32_t>::max() )
+            throw std::runtime_error( "catalog is too large for shared memory image" );
+
+        String res;
+
+        res.offset  = pool.size();
+        res.size    = s.size();
+
+        pool.append( s );
+
+        return res;
+    };
+
+    // records come grouped by template, sorted by id and locale
+
+    uint32_t total_size;
+
+    std::map<std::string, Name> sorted_names;   // sorted in the order of std::string::compare
+
+    for( auto & r : keeper.find_templates( & total_size, 0, "", lang_tools::lang_e::UNDEF ) )
+    {
+        if( templs.empty() || templs.back().id != r.id )
+        {
+            Template e;
+
+            e.id            = r.id;
+            e.category_id   = r.category_id;
+            e.name          = add_string( r.name );
+            e.first_loc     = locs.size();
+            e.num_locs      = 0;
+
+            templs.push_back( e );
+
+            if( keeper.find_template_id_by_name( r.name ) == r.id )
+            {
+                Name n;
+
+                n.name  = e.name;
+                n.id    = r.id;
+
+                sorted_names.insert( std::make_pair( r.name, n ) );
+            }
+        }
+
+        LocalizedTemplate loc;
+
+        loc.locale  = static_cast<uint32_t>( r.locale );
+        loc.name    = add_string( r.localized_name );
+        loc.templ   = add_string( r.templ );
+
+        locs.push_back( loc );
+
+        ++templs.back().num_locs;
+    }
+
+    for( auto & n : sorted_names )
+        names.push_back( n.second );
+
+    auto align = []( uint64_t offset )
+    {
+        return ( offset + 7 ) & ~uint64_t( 7 );
+    };
+
+    Header header;
+
+    memset( & header, 0, sizeof( header ) );
+
+    header.magic            = MAGIC;
+    header.version          = VERSION;
+    header.generation       = generation;
+    header.num_templs       = templs.size();
+    header.num_locs         = locs.size();
+    header.num_names        = names.size();
+    header.templs_offset    = align( sizeof( Header ) );
+    header.locs_offset      = align( header.templs_offset + templs.size() * sizeof( Template ) );
+    header.names_offset     = align( header.locs_offset + locs.size() * sizeof( LocalizedTemplate ) );
+    header.strings_offset   = align( header.names_offset + names.size() * sizeof( Name ) );
+    header.size             = header.strings_offset + pool.size();
+
+    std::string res( header.size, '\0' );
+
+    memcpy( & res[0], & header, sizeof( header ) );
+
+    if( templs.empty() == false )
+        memcpy( & res[ header.templs_offset ], templs.data(), templs.size() * sizeof( Template ) );
+
+    if( locs.empty() == false )
+        memcpy( & res[ header.locs_offset ], locs.data(), locs.size() * sizeof( LocalizedTemplate ) );
+
+    if( names.empty() == false )
+        memcpy( & res[ header.names_offset ], names.data(), names.size() * sizeof( Name ) );
+
+    if( pool.empty() == false )
+        memcpy( & res[ header.strings_offset ], pool.data(), pool.size() );
+
+    return res;
+}
+
+std::string ShmTemplTextKeeper::to_data_name( const std::string & shm_name, uint64_t generation )
+{
+    return shm_name + "." + std::to_string( generation );
+}
+
+ShmTemplTextKeeper::Control * ShmTemplTextKeeper::open_control( const std::string & shm_name, Mapping & mapping, bool is_writable )
+{
+    mapping.map( shm_name, is_writable, sizeof( Control ) );
+
+    if( mapping.get_size() < sizeof( Control ) )
+        throw std::runtime_error( "invalid control segment '" + shm_name + "'" );
+
+    auto res = static_cast<Control*>( mapping.get_addr() );
+
+    // a new segment is zero-filled, i.e. has generation 0
+    if( is_writable == false && ( res->magic != MAGIC || res->version != VERSION ) )
+        throw std::runtime_error( "invalid control segment '" + shm_name + "'" );
+
+    return res;
+}
+
+void ShmTemplTextKeeper::map_current()
+{
+    static const unsigned MAX_ATTEMPTS = 10;
+
+    auto control = static_cast<const Control*>( control_.get_addr() );
+
+    Mapping data;
+
+    for( unsigned i = 0; ; ++i )
+    {
+        auto generation = control->generation.load( std::memory_order_acquire );
+
+        if( generation == 0 )
+            throw std::runtime_error( "nothing published in '" + shm_name_ + "'" );
+
+        try
+        {
+            data.map( to_data_name( shm_name_, generation ), false );
+            break;
+        }
+        catch( std::exception & )
+        {
+            // the segment may have been replaced and unlinked meanwhile
+            if( i + 1 == MAX_ATTEMPTS || control->generation.load( std::memory_order_acquire ) == generation )
+                throw;
+        }
+    }
+
+    auto header = static_cast<const Header*>( data.get_addr() );
+
+    if( data.get_size() < sizeof( Header ) || header->magic != MAGIC || header->version != VERSION || header->size > data.get_size() )
+        throw std::runtime_error( "invalid shared memory image in '" + shm_name_ + "'" );
+
+    if( header->templs_offset + uint64_t( header->num_templs ) * sizeof( Template ) > header->size
+            || header->locs_offset + uint64_t( header->num_locs ) * sizeof( LocalizedTemplate ) > header->size
+            || header->names_offset + uint64_t( header->num_names ) * sizeof( Name ) > header->size
+            || header->strings_offset > header->size )
+        throw std::runtime_error( "corrupted shared memory image in '" + shm_name_ + "'" );
+
+    std::unique_ptr<TemplPtr[]> templs( new TemplPtr[ header->num_locs ] );
+
+    for( uint32_t i = 0; i < header->num_locs; ++i )
+        templs[i].store( nullptr, std::memory_order_relaxed );
+
+    release_templs();
+
+    data_.swap( data );
+    templs_.swap( templs );
+}
+
+void ShmTemplTextKeeper::release_templs()
+{
+    auto header = get_header();
+
+    if( header == nullptr )
+        return;
+
+    for( uint32_t i = 0; i < header->num_locs; ++i )
+        delete templs_[i].load( std::memory_order_relaxed );
+}
+
+const ShmTemplTextKeeper::Header * ShmTemplTextKeeper::get_header() const
+{
+    return static_cast<const Header*>( data_.get_addr() );
+}
+
+const ShmTemplTextKeeper::Template * ShmTemplTextKeeper::find_template( id_t id ) const
+{
+    auto header = get_header();
+
+    if( header == nullptr )
+        return nullptr;
+
+    auto begin  = reinterpret_cast<const Template*>( reinterpret_cast<const char*>( header ) + header->templs_offset );
+    auto end    = begin + header->num_templs;
+
+    auto it = std::lower_bound( begin, end, id, []( const Template & t, id_t id ) { return t.id < id; } );
+
+    if( it == end || it->id != id )
+        return nullptr;
+
+    return it;
+}
+
+const ShmTemplTextKeeper::LocalizedTemplate * ShmTemplTextKeeper::find_localized_templ( id_t id, lang_tools::lang_e locale ) const
+{
+    auto t = find_template( id );
+
+    if( t == nullptr )
+        return nullptr;
+
+    auto header = get_header();
+
+    auto locs = reinterpret_cast<const LocalizedTemplate*>( reinterpret_cast<const char*>( header ) + header->locs_offset );
+
+    for( uint32_t i = t->first_loc; i < t->first_loc + t->num_locs; ++i )
+    {
+        if( locs[i].locale == static_cast<uint32_t>( locale ) )
+            return & locs[i];
+    }
+
+    return nullptr;
+}
+
+std::string ShmTemplTextKeeper::to_string( const String & s ) const
+{
+    auto header = get_header();
+
+    return std::string( reinterpret_cast<const char*>( header ) + header->strings_offset + s.offset, s.size );
+}
+
+bool ShmTemplTextKeeper::has_template( id_t id, lang_tools::lang_e locale ) const
+{
+    return find_localized_templ( id, locale ) != nullptr;
+}
+
+const ShmTemplTextKeeper::Templ * ShmTemplTextKeeper::get_template( id_t id, lang_tools::lang_e locale ) const
+{
+    auto l = find_localized_templ( id, locale );
+
+    if( l == nullptr )
+        return nullptr;
+
+    auto header = get_header();
+
+    auto & t = templs_[ l - reinterpret_cast<const LocalizedTemplate*>( reinterpret_cast<const char*>( header ) + header->locs_offset ) ];
+
+    // compiled templates are published by the atomic pointer, the lock is only taken to compile
+
+    auto res = t.load( std::memory_order_acquire );
+
+    if( res )
+        return res;
+
+    std::lock_guard<std::mutex> lock( mutex_ );
+
+    res = t.load( std::memory_order_relaxed );
+
+    if( res == nullptr )
+    {
+        res = new Templ( to_string( l->templ ), to_string( l->name ) );
+
+        t.store( res, std::memory_order_release );
+    }
+
+    return res;
+}
+
+id_t ShmTemplTextKeeper::find_template_id_by_name( const std::string & name ) const
+{
+    auto header = get_header();
+
+    if( header == nullptr )
+        return 0;
+
+    auto base       = reinterpret_cast<const char*>( header );
+    auto strings    = base + header->strings_offset;
+    auto begin      = reinterpret_cast<const Name*>( base + header->names_offset );
+    auto end        = begin + header->num_names;
+
+    // same order as std::string::compare
+    auto compare = [&]( const String & s ) -> int
+    {
+        auto res = memcmp( strings + s.offset, name.data(), std::min<size_t>( s.size, name.size() ) );
+
+        if( res != 0 )
+            return res;
+
+        return s.size < name.size() ? -1 : ( s.size > name.size() ? 1 : 0 );
+    };
+
+    auto it = std::lower_bound( begin, end, name, [&]( const Name & n, const std::string & ) { return compare( n.name ) < 0; } );
+
+    if( it == end || compare( it->name ) != 0 )
+        return 0;
+
+    return it->id;
+}
+
+ShmTemplTextKeeper::Records ShmTemplTextKeeper::find_templates(
+        uint32_t            * total_size,
+        category_id_t       category_id,
+        const std::string   & filter,
+        lang_tools::lang_e  locale,
+        uint32_t            page_size,
+        uint32_t            page_num ) const
+{
+    Records res;
+
+    * total_size = 0;
+
+    auto header = get_header();
+
+    if( header == nullptr )
+        return res;
+
+    auto base   = reinterpret_cast<const char*>( header );
+    auto templs = reinterpret_cast<const Template*>( base + header->templs_offset );
+    auto locs   = reinterpret_cast<const LocalizedTemplate*>( base + header->locs_offset );
+
+    auto offset     = page_size * page_num;
+    auto offset_end = offset + page_size;
+
+    unsigned i = 0;
+
+    for( uint32_t k = 0; k < header->num_templs; ++k )
+    {
+        auto & t = templs[k];
+
+        if( category_id != 0 && category_id != t.category_id )
+            continue;
+
+        for( uint32_t n = t.first_loc; n < t.first_loc + t.num_locs; ++n )
+        {
+            auto & l = locs[n];
+
+            if( locale != lang_tools::lang_e::UNDEF && static_cast<uint32_t>( locale ) != l.locale )
+                continue;
+
+            if( utils::match_filter( to_string( l.name ), filter, true ) == false )
+                continue;
+
+            // return only those elements, which belong to the desired page
+            if( i >= offset && i < offset_end )
+            {
+                res.push_back( to_record( t, l ) );
+            }
+
+            i++;
+        }
+    }
+
+    * total_size  = i;
+
+    return res;
+}
+
+ShmTemplTextKeeper::Record ShmTemplTextKeeper::to_record( const Template & t, const LocalizedTemplate & l ) const
+{
+    Record r;
+
+    r.id                = t.id;
+    r.category_id       = t.category_id;
+    r.name              = to_string( t.name );
+
+    r.locale            = static_cast<lang_tools::lang_e>( l.locale );
+    r.localized_name    = to_string( l.name );
+    r.templ             = to_string( l.templ );
+
+    return r;
+}
+
+NAMESPACE_TEMPLTEXTKEEPER_END
@@ -0,0 +1,181 @@
+/*
+
+Text Template Keeper library - Shared Memory Keeper.
+
+Copyright (C) 2015 Sergey Kolevatov
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// $Revision: 8742 $ $Date:: 2018-03-12 #$ $Author: serge $
+
+#ifndef LIB_TEMPLTEXTKEEPER_SHM_TEMPLTEXTKEEPER_H
+#define LIB_TEMPLTEXTKEEPER_SHM_TEMPLTEXTKEEPER_H
+
+#include <string>                   // std::string
+#include <atomic>                   // std::atomic
+#include <memory>                   // std::unique_ptr
+#include <mutex>                    // std::mutex
+#include <limits>                   // std::numeric_limits
+
+#include "templtextkeeper.h"        // TemplTextKeeper
+
+NAMESPACE_TEMPLTEXTKEEPER_START
+
+/**
+ * @brief Read-only view of a catalog published into POSIX shared memory.
+ *
+ * One process loads a TemplTextKeeper and publishes it, worker processes attach to the image
+ * instead of loading the catalog each. The image contains only offsets, so it can be mapped
+ * at any address. Every publish creates a new segment '<shm_name>.<generation>' and then
+ * switches the generation in the control segment '<shm_name>', attached keepers pick up
+ * the new image on refresh().
+ */
+class ShmTemplTextKeeper
+{
+public:
+
+    typedef TemplTextKeeper::Templ      Templ;
+    typedef TemplTextKeeper::Record     Record;
+    typedef TemplTextKeeper::Records    Records;
+
+public:
+
+    ShmTemplTextKeeper();
+    ~ShmTemplTextKeeper();
+
+    /**
+     * @brief writes the catalog into a new segment and makes it current, the previous segment is unlinked
+     *
+     * Processes that have mapped the previous segment keep using it until refresh().
+     *
+     * @param shm_name  name of the control segment, e.g. "/templates"
+     * @return generation of the published image
+     * @throw std::runtime_error on errors of the shared memory calls
+     */
+    static uint64_t publish( const std::string & shm_name, const TemplTextKeeper & keeper );
+
+    /**
+     * @brief unlinks the control and the current data segment
+     */
+    static void remove( const std::string & shm_name );
+
+    /**
+     * @throw std::runtime_error if nothing is published under the name or the image is invalid
+     */
+    void attach( const std::string & shm_name );
+
+    /**
+     * @brief switches to the current image if a newer one has been published
+     *
+     * Invalidates the pointers returned by get_template(). Must not be called concurrently with other methods.
+     *
+     * @return false if the image hasn't changed
+     */
+    bool refresh();
+
+    uint64_t get_generation() const;
+
+    Records find_templates(
+            uint32_t            * total_size,
+            category_id_t       category_id,
+            const std::string   & filter,
+            lang_tools::lang_e  locale,
+            uint32_t            page_size   = std::numeric_limits<uint32_t>::max(),
+            uint32_t            page_num    = 0 ) const;
+
+    bool has_template( id_t id, lang_tools::lang_e locale ) const;
+
+    /**
+     * @brief returns the template compiled on first use in this process, later calls take no lock
+     */
+    const Templ * get_template( id_t id, lang_tools::lang_e locale ) const;
+
+    /**
+     * @brief unlike TemplTextKeeper::find_template_id_by_name() returns 0 for templates without localized versions,
+     *        the image is built from TemplTextKeeper::find_templates() which doesn't return them
+     */
+    id_t find_template_id_by_name( const std::string & name ) const;
+
+private:
+
+    struct Control;
+    struct Header;
+    struct String;
+    struct Template;
+    struct LocalizedTemplate;
+    struct Name;
+
+    class Mapping
+    {
+    public:
+
+        Mapping();
+        ~Mapping();
+
+        void map( const std::string & name, bool is_writable, size_t size = 0 );
+        void unmap();
+        void swap( Mapping & r );
+
+        void    * get_addr() const;
+        size_t  get_size() const;
+
+    private:
+
+        Mapping( const Mapping & );
+        Mapping & operator=( const Mapping & );
+
+    private:
+
+        void    * addr_;
+        size_t  size_;
+    };
+
+    typedef std::atomic<Templ *>    TemplPtr;
+
+    static const uint32_t MAGIC     = 0x4B545454;   // "TTTK"
+    static const uint32_t VERSION   = 1;
+
+private:
+
+    static std::string build_image( const TemplTextKeeper & keeper, uint64_t generation );
+    static std::string to_data_name( const std::string & shm_name, uint64_t generation );
+
+    static Control * open_control( const std::string & shm_name, Mapping & mapping, bool is_writable );
+
+    void map_current();
+
+    const Header * get_header() const;
+    const Template * find_template( id_t id ) const;
+    const LocalizedTemplate * find_localized_templ( id_t id, lang_tools::lang_e locale ) const;
+    void release_templs();
+    std::string to_string( const String & s ) const;
+
+    Record to_record( const Template & t, const LocalizedTemplate & l ) const;
+
+private:
+
+    std::string             shm_name_;
+
+    Mapping                 control_;
+    Mapping                 data_;
+
+    std::unique_ptr<TemplPtr[]> templs_;    // localized template --> template compiled in this process, null until first use
+    mutable std::mutex      mutex_;     // serializes the compilation
+};
+
+NAMESPACE_TEMPLTEXTKEEPER_END
+
+#endif // LIB_TEMPLTEXTKEEPER_SHM_TEMPLTEXTKEEPER_H
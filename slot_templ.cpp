@@ -0,0 +1,311 @@
+/*
+
+Text Template Keeper library - Slot Template.
+
+Copyright (C) 2015 Sergey Kolevatov
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// $Revision: 8742 $ $Date:: 2018-03-12 #$ $Author: serge $
+
+#include "slot_templ.h"                 // self
+
+#include <stdexcept>                    // std::runtime_error
+#include <algorithm>                    // std::find
+
+NAMESPACE_TEMPLTEXTKEEPER_START
+
+const slot_t SlotTempl::INVALID_SLOT;
+
+SlotTempl::SlotTempl(
+        const std::string   & templ,
+        MapNameToSlot       & name_to_slot ):
+        literal_size_( 0 ),
+        required_args_( 0 ),
+        has_functions_( false )
+{
+    parse( templ, & name_to_slot, name_to_slot );
+}
+
+SlotTempl::SlotTempl(
+        const std::string   & templ,
+        const MapNameToSlot & name_to_slot ):
+        literal_size_( 0 ),
+        required_args_( 0 ),
+        has_functions_( false )
+{
+    parse( templ, nullptr, name_to_slot );
+}
+
+bool SlotTempl::has_functions() const
+{
+    return has_functions_;
+}
+
+const SlotTempl::Slots & SlotTempl::get_slots() const
+{
+    return slots_;
+}
+
+const SlotTempl::Functions & SlotTempl::get_functions() const
+{
+    return functions_;
+}
+
+const SlotTempl::Errors & SlotTempl::get_errors() const
+{
+    return errors_;
+}
+
+size_t SlotTempl::get_literal_size() const
+{
+    return literal_size_;
+}
+
+uint32_t SlotTempl::get_required_args() const
+{
+    return required_args_;
+}
+
+bool SlotTempl::validate_args( const Args & args, slot_t & missing_slot ) const
+{
+    for( auto s : slots_ )
+    {
+        if( s >= args.size() )
+        {
+            missing_slot = s;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+std::string SlotTempl::format( const Args & args, bool throw_on_error ) const
+{
+    std::string res;
+
+    res.reserve( literal_size_ + 16 * slots_.size() );
+
+    for( auto & s : segments_ )
+    {
+        if( s.slot == INVALID_SLOT )
+        {
+            res.append( s.literal );
+        }
+        else if( s.slot < args.size() )
+        {
+            res.append( args[ s.slot ] );
+        }
+        else if( throw_on_error )
+        {
+            throw std::runtime_error( "missing argument for slot " + std::to_string( s.slot ) );
+        }
+    }
+
+    return res;
+}
+
+std::string SlotTempl::format_unchecked( const Args & args, size_t size_hint ) const
+{
+    std::string res;
+
+    res.reserve( size_hint );
+
+    for( auto & s : segments_ )
+    {
+        if( s.slot == INVALID_SLOT )
+            res.append( s.literal );
+        else
+            res.append( args[ s.slot ] );
+    }
+
+    return res;
+}
+
+std::string SlotTempl::format_local( const Args & local_args, size_t size_hint ) const
+{
+    std::string res;
+
+    res.reserve( size_hint );
+
+    for( auto & s : segments_ )
+    {
+        if( s.slot == INVALID_SLOT )
+            res.append( s.literal );
+        else
+            res.append( local_args[ s.index ] );
+    }
+
+    return res;
+}
+
+void SlotTempl::parse( const std::string & templ, MapNameToSlot * registry, const MapNameToSlot & name_to_slot )
+{
+    // syntax: $NAME, ${NAME}, %func( ... )
+
+    std::string literal;
+
+    auto size = templ.size();
+
+    size_t i = 0;
+
+    while( i < size )
+    {
+        auto c = templ[i];
+
+        if( c == '$' && i + 1 < size )
+        {
+            if( templ[i + 1] == '{' )
+            {
+                auto end = templ.find( '}', i + 2 );
+
+                // rejected like templtext does, instead of being formatted as literal text
+
+                if( end == std::string::npos )
+                    throw std::runtime_error( "unbalanced '${' at position " + std::to_string( i ) );
+
+                auto name = templ.substr( i + 2, end - i - 2 );
+
+                if( name.empty() || std::find_if_not( name.begin(), name.end(), is_name_char ) != name.end() )
+                    throw std::runtime_error( "invalid placeholder '" + templ.substr( i, end - i + 1 ) + "' at position " + std::to_string( i ) );
+
+                add_literal( literal );
+                literal.clear();
+                add_placeholder( name, registry, name_to_slot );
+                i = end + 1;
+                continue;
+            }
+            else
+            {
+                auto end = i + 1;
+
+                while( end < size && is_name_char( templ[end] ) )
+                    ++end;
+
+                if( end > i + 1 )
+                {
+                    add_literal( literal );
+                    literal.clear();
+                    add_placeholder( templ.substr( i + 1, end - i - 1 ), registry, name_to_slot );
+                    i = end;
+                    continue;
+                }
+            }
+        }
+        else if( c == '%' )
+        {
+            auto end = i + 1;
+
+            while( end < size && is_name_char( templ[end] ) )
+                ++end;
+
+            if( end > i + 1 && end < size && templ[end] == '(' )
+                add_function( templ, i, end );
+        }
+
+        literal += c;
+        ++i;
+    }
+
+    add_literal( literal );
+}
+
+void SlotTempl::add_literal( const std::string & s )
+{
+    if( s.empty() )
+        return;
+
+    Segment seg;
+
+    seg.literal = s;
+    seg.slot    = INVALID_SLOT;
+    seg.index   = 0;
+
+    segments_.push_back( seg );
+
+    literal_size_ += s.size();
+}
+
+void SlotTempl::add_placeholder( const std::string & name, MapNameToSlot * registry, const MapNameToSlot & name_to_slot )
+{
+    Segment seg;
+
+    if( registry )
+    {
+        auto slot = static_cast<slot_t>( registry->size() );
+
+        seg.slot = registry->insert( MapNameToSlot::value_type( name, slot ) ).first->second;
+    }
+    else
+    {
+        auto it = name_to_slot.find( name );
+
+        if( it == name_to_slot.end() )
+            throw std::runtime_error( "unknown placeholder '" + name + "'" );
+
+        seg.slot = it->second;
+    }
+
+    auto it = std::find( slots_.begin(), slots_.end(), seg.slot );
+
+    seg.index = it - slots_.begin();
+
+    if( it == slots_.end() )
+        slots_.push_back( seg.slot );
+
+    segments_.push_back( seg );
+
+    if( seg.slot + 1 > required_args_ )
+        required_args_ = seg.slot + 1;
+}
+
+void SlotTempl::add_function( const std::string & templ, size_t pos, size_t name_end )
+{
+    Function f;
+
+    f.name  = templ.substr( pos + 1, name_end - pos - 1 );
+    f.pos   = pos;
+
+    functions_.push_back( f );
+
+    has_functions_ = true;
+
+    // the call ends at the matching parenthesis
+
+    uint32_t depth = 0;
+
+    for( auto i = name_end; i < templ.size(); ++i )
+    {
+        if( templ[i] == '(' )
+        {
+            ++depth;
+        }
+        else if( templ[i] == ')' && --depth == 0 )
+        {
+            return;
+        }
+    }
+
+    errors_.push_back( "unbalanced '(' of function '" + f.name + "' at position " + std::to_string( name_end ) );
+}
+
+bool SlotTempl::is_name_char( char c )
+{
+    return ( c >= 'A' && c <= 'Z' ) || ( c >= 'a' && c <= 'z' ) || ( c >= '0' && c <= '9' ) || c == '_';
+}
+
+NAMESPACE_TEMPLTEXTKEEPER_END
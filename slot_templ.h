@@ -0,0 +1,159 @@
+/*
+
+Text Template Keeper library - Slot Template.
+
+Copyright (C) 2015 Sergey Kolevatov
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// $Revision: 8742 $ $Date:: 2018-03-12 #$ $Author: serge $
+
+#ifndef LIB_TEMPLTEXTKEEPER_SLOT_TEMPL_H
+#define LIB_TEMPLTEXTKEEPER_SLOT_TEMPL_H
+
+#include <string>                   // std::string
+#include <vector>                   // std::vector
+#include <map>                      // std::map
+#include <limits>                   // std::numeric_limits
+
+#include "types.h"                  // slot_t
+
+NAMESPACE_TEMPLTEXTKEEPER_START
+
+/**
+ * @brief Template compiled into literal and placeholder segments.
+ *
+ * Placeholders ($NAME, ${NAME}) are resolved to integer slots once, at construction,
+ * so formatting takes an argument vector indexed by slot and does no string lookups.
+ * Function calls (%func( ... )) are not expanded here, see has_functions().
+ */
+class SlotTempl
+{
+public:
+    typedef std::map<std::string, slot_t>   MapNameToSlot;
+    typedef std::vector<std::string>        Args;
+    typedef std::vector<slot_t>             Slots;
+    typedef std::vector<std::string>        Errors;
+
+    struct Function
+    {
+        std::string name;
+        uint32_t    pos;        // position of '%' in the template
+    };
+
+    typedef std::vector<Function>           Functions;
+
+    static const slot_t INVALID_SLOT = std::numeric_limits<slot_t>::max();
+
+public:
+
+    /**
+     * @param templ         template text
+     * @param name_to_slot  slot registry, unknown placeholder names are appended to it
+     * @throw std::runtime_error on an unbalanced '${' or an invalid name in '${...}'
+     */
+    SlotTempl(
+            const std::string   & templ,
+            MapNameToSlot       & name_to_slot );
+
+    /**
+     * @throw std::runtime_error if a placeholder is not in the registry or on the errors above
+     */
+    SlotTempl(
+            const std::string   & templ,
+            const MapNameToSlot & name_to_slot );
+
+    bool has_functions() const;
+
+    const Slots & get_slots() const;
+    const Functions & get_functions() const;
+
+    /**
+     * @brief syntax errors found at construction that don't prevent formatting: unbalanced '%func('
+     */
+    const Errors & get_errors() const;
+
+    /**
+     * @brief total size of the literal segments
+     */
+    size_t get_literal_size() const;
+
+    /**
+     * @brief minimal size of an argument vector that has all slots of the template
+     */
+    uint32_t get_required_args() const;
+
+    bool validate_args( const Args & args, slot_t & missing_slot ) const;
+
+    /**
+     * @brief formats the template
+     *
+     * Only slots beyond args.size() are treated as missing: an exception is thrown
+     * if throw_on_error is set, otherwise they are substituted by an empty string.
+     * An element of args that exists but has not been assigned is an empty argument,
+     * not a missing one, so Args( n ) with n covering all slots never throws.
+     */
+    std::string format( const Args & args, bool throw_on_error = true ) const;
+
+    /**
+     * @brief formats the template without checking the arguments
+     *
+     * @pre     args.size() >= get_required_args()
+     */
+    std::string format_unchecked( const Args & args, size_t size_hint ) const;
+
+    /**
+     * @brief formats the template with arguments in the order of get_slots()
+     *
+     * @pre     local_args.size() == get_slots().size()
+     */
+    std::string format_local( const Args & local_args, size_t size_hint ) const;
+
+private:
+
+    struct Segment
+    {
+        std::string literal;
+        slot_t      slot;       // INVALID_SLOT for literal segments
+        uint32_t    index;      // index of the slot in slots_
+    };
+
+    typedef std::vector<Segment> Segments;
+
+private:
+
+    void parse( const std::string & templ, MapNameToSlot * registry, const MapNameToSlot & name_to_slot );
+
+    void add_literal( const std::string & s );
+    void add_placeholder( const std::string & name, MapNameToSlot * registry, const MapNameToSlot & name_to_slot );
+    void add_function( const std::string & templ, size_t pos, size_t name_end );
+
+    static bool is_name_char( char c );
+
+private:
+
+    Segments    segments_;
+    Slots       slots_;             // unique slots used by the template, in order of appearance
+    Functions   functions_;
+    Errors      errors_;
+    size_t      literal_size_;
+    uint32_t    required_args_;
+    bool        has_functions_;
+};
+
+NAMESPACE_TEMPLTEXTKEEPER_END
+
+#endif // LIB_TEMPLTEXTKEEPER_SLOT_TEMPL_H
@@ -30,10 +30,36 @@ along with this program. If not, see <http://www.gnu.org/licenses/>.
 #include "lang_tools/str_helper.h"      // lang_tools::to_string_iso
 
 #include <stdexcept>                    // std::invalid_argument
+#include <fstream>                      // std::ofstream, std::ifstream
+#include <algorithm>                    // std::sort
+#include <set>                          // std::set
+#include <unordered_set>                // std::unordered_set
+#include <cstring>                      // memchr, memcpy
+#include <thread>                       // std::thread
+#include <system_error>                 // std::system_error
+#include <exception>                    // std::exception_ptr
+#include <memory>                       // std::unique_ptr
+#include <sys/stat.h>                   // stat
+#include <sys/mman.h>                   // mmap
+#include <fcntl.h>                      // open
+#include <unistd.h>                     // close
 
 NAMESPACE_TEMPLTEXTKEEPER_START
 
-TemplTextKeeper::TemplTextKeeper()
+const uint32_t TemplTextKeeper::HOT_TABLE_SIZE;
+const uint32_t TemplTextKeeper::AVG_ARG_SIZE;
+const uint32_t TemplTextKeeper::MIN_TEMPLS_PER_THREAD;
+const uint32_t TemplTextKeeper::GENERAL_LOCALE;
+const uint64_t TemplTextKeeper::BLOCK_MASK;
+const uint32_t TemplTextKeeper::MAX_BLOCK_LINES;
+
+TemplTextKeeper::TemplTextKeeper():
+        is_compressed_( false ),
+        raw_size_( 0 ),
+        packed_size_( 0 ),
+        is_search_index_built_( false ),
+        sampling_rate_( 0 ),
+        hot_table_( nullptr )
 {
 }
 
@@ -42,159 +68,1601 @@ TemplTextKeeper::~TemplTextKeeper()
     for( auto & e : templs_ )
     {
         for( auto & t : e.second.localized_templ_info )
+        {
             delete t.second.t;
+            delete t.second.st;
+        }
     }
 }
 
+TemplTextKeeper::LocalizedTemplateInfo::LocalizedTemplateInfo():
+        t( nullptr ),
+        st( nullptr ),
+        is_compiled( false ),
+        estimated_size( 0 )
+{
+}
+
+TemplTextKeeper::LocalizedTemplateInfo::LocalizedTemplateInfo( const LocalizedTemplateInfo & r ):
+        name( r.name ),
+        templ( r.templ ),
+        packed( r.packed ),
+        t( r.t ),
+        st( r.st ),
+        is_compiled( r.is_compiled.load() ),
+        estimated_size( r.estimated_size )
+{
+}
+
 bool TemplTextKeeper::init(
-        const std::string & config_file )
+        const std::string & config_file,
+        bool                compress_bodies )
 {
     if( config_file.empty() )
         return false;
 
-    try
+    is_compressed_  = compress_bodies;
+    config_file_    = config_file;
+
+    try
+    {
+        get_file_stamp( config_file, & file_stamp_ );
+
+        MappedFile file( config_file );
+
+        parse_file( file );
+
+        compile_templates();
+
+        std::vector<MapIdToTemplateInfo::value_type *> templs;
+
+        for( auto & e : templs_ )
+            templs.push_back( & e );
+
+        for( auto & i : validate_templates( templs, slots_, slot_names_ ) )
+            issues_[ i.id ].push_back( i );
+
+        if( is_compressed_ )
+            this->compress_bodies();
+
+        for( auto & e : templs_ )
+        {
+            for( auto & l : e.second.localized_templ_info )
+                release_uncompiled( l.second );
+        }
+
+        build_hot_table();
+    }
+    catch( std::exception & e )
+    {
+        throw e;
+    }
+
+    return true;
+}
+
+bool TemplTextKeeper::reload()
+{
+    FileStamp stamp;
+
+    if( get_file_stamp( config_file_, & stamp ) && stamp == file_stamp_ )
+        return false;
+
+    MappedFile file( config_file_ );
+
+    // the keeper is not modified until the changes are parsed, compiled and validated
+
+    Changes changes;
+
+    if( find_changes( file, & changes ) == false )
+    {
+        file_stamp_ = stamp;
+
+        return false;
+    }
+
+    stage_changes( & changes );
+
+    apply_changes( changes );
+
+    update_derived( changes );
+
+    file_stamp_ = stamp;
+
+    return true;
+}
+
+bool TemplTextKeeper::find_changes( const MappedFile & file, Changes * changes ) const
+{
+    std::vector<BlockRef> blocks;
+
+    split_blocks( file, & blocks );
+
+    // blocks seen at the last load are skipped, only the lines of the other ones are parsed
+
+    std::unordered_map<uint64_t, uint32_t> unmatched;
+
+    for( auto & b : blocks_ )
+        unmatched[ b.first ] = b.second.count;
+
+    for( auto & b : blocks )
+    {
+        auto it = unmatched.find( b.hash );
+
+        if( it != unmatched.end() && it->second > 0 )
+            --it->second;
+        else
+            changes->new_blocks.push_back( b );
+    }
+
+    // records of the vanished blocks were changed, moved or removed
+
+    std::unordered_set<uint64_t> vanished_keys;
+
+    for( auto & u : unmatched )
+    {
+        for( uint32_t i = 0; i < u.second; ++i )
+        {
+            auto & keys = blocks_.find( u.first )->second.keys;
+
+            changes->vanished_blocks.push_back( u.first );
+
+            vanished_keys.insert( keys.begin(), keys.end() );
+        }
+    }
+
+    if( changes->new_blocks.empty() && changes->vanished_blocks.empty() )
+        return false;
+
+    std::unordered_set<uint64_t> seen_keys;     // records of the new blocks
+
+    std::vector<Line> lines;
+
+    for( auto & b : changes->new_blocks )
+    {
+        changes->new_block_keys.push_back( std::vector<uint64_t>() );
+
+        auto & block_keys = changes->new_block_keys.back();
+
+        get_lines( file, b, & lines );
+
+        for( auto & line : lines )
+        {
+            std::string l( file.get_data() + line.begin, line.size );
+
+            auto k      = to_line_key( l );
+            auto key    = to_record_key( k );
+
+            auto it = line_hashes_.find( key );
+
+            // the record is either repeated in the new blocks or still in an unchanged one
+            bool is_duplicate = ( seen_keys.insert( key ).second == false )
+                    || ( it != line_hashes_.end() && vanished_keys.count( key ) == 0 );
+
+            if( is_duplicate )
+            {
+                if( k.type == 'T' )
+                    throw std::runtime_error( "duplicate template id " + std::to_string( k.id ) );
+
+                throw std::runtime_error( "template " + std::to_string( k.id ) + " has already locale " + lang_tools::to_string_iso( k.locale ) );
+            }
+
+            block_keys.push_back( key );
+
+            // unchanged record in a changed block
+            if( it != line_hashes_.end() && it->second == line.hash )
+                continue;
+
+            if( k.type == 'T' )
+            {
+                changes->changed_t.push_back( GeneralTemplateToHash( to_general_templ( l ), line.hash ) );
+            }
+            else
+            {
+                StagedTempl s;
+
+                s.e     = to_localized_templ( l );
+                s.hash  = line.hash;
+                s.raw_size          = 0;
+                s.estimated_size    = 0;
+
+                changes->changed_l.push_back( std::move( s ) );
+            }
+        }
+    }
+
+    for( auto key : vanished_keys )
+    {
+        if( seen_keys.count( key ) )
+            continue;
+
+        if( static_cast<uint32_t>( key ) == GENERAL_LOCALE )
+            changes->removed_t.push_back( to_id( key ) );
+        else
+            changes->removed_l.push_back( key );
+    }
+
+    std::sort( changes->removed_t.begin(), changes->removed_t.end() );
+    std::sort( changes->removed_l.begin(), changes->removed_l.end() );
+
+    // localized templates must not lose their general template
+
+    for( auto & s : changes->changed_l )
+    {
+        LineKey k;
+
+        k.type      = 'T';
+        k.id        = s.e.id;
+        k.locale    = lang_tools::lang_e::UNDEF;
+
+        auto key = to_record_key( k );
+
+        bool is_removed = std::binary_search( changes->removed_t.begin(), changes->removed_t.end(), s.e.id );
+
+        if( seen_keys.count( key ) == 0 && ( line_hashes_.count( key ) == 0 || is_removed ) )
+            throw std::runtime_error( "cannot find template id " + std::to_string( s.e.id ) );
+    }
+
+    for( auto id : changes->removed_t )
+    {
+        for( auto & l : templs_.find( id )->second.localized_templ_info )
+        {
+            auto key = to_key( id, l.first );
+
+            if( std::binary_search( changes->removed_l.begin(), changes->removed_l.end(), key ) == false )
+                throw std::runtime_error( "cannot find template id " + std::to_string( id ) );
+        }
+    }
+
+    std::vector<GeneralTemplate> changed_t_templs;
+
+    for( auto & e : changes->changed_t )
+        changed_t_templs.push_back( e.first );
+
+    check_names( changed_t_templs, changes->removed_t );
+
+    return true;
+}
+
+void TemplTextKeeper::stage_changes( Changes * changes ) const
+{
+    // new placeholders are interned into a copy of the registry
+
+    changes->slots  = slots_;
+
+    for( auto & s : changes->changed_l )
+    {
+        s.st.reset( new SlotTempl( s.e.templ, changes->slots ) );
+
+        if( is_compressed_ )
+        {
+            s.packed    = codec_.compress( s.e.templ );
+            s.raw_size  = s.e.templ.size();
+        }
+        else
+        {
+            s.t.reset( new Templ( s.e.templ, s.e.name ) );
+        }
+    }
+
+    changes->slot_names = slot_names_;
+    changes->slot_names.resize( changes->slots.size() );
+
+    for( auto & s : changes->slots )
+        changes->slot_names[ s.second ] = s.first;
+
+    // the affected templates are validated on a view of their state after the reload
+
+    std::set<id_t>  ids;
+    std::set<uint64_t>  replaced_keys( changes->removed_l.begin(), changes->removed_l.end() );
+
+    for( auto & e : changes->changed_t )
+        ids.insert( e.first.id );
+
+    for( auto & s : changes->changed_l )
+    {
+        ids.insert( s.e.id );
+        replaced_keys.insert( to_key( s.e.id, s.e.locale ) );
+    }
+
+    for( auto key : changes->removed_l )
+        ids.insert( to_id( key ) );
+
+    for( auto id : changes->removed_t )
+        ids.erase( id );
+
+    MapIdToTemplateInfo view;      // doesn't own the compiled templates
+
+    for( auto id : ids )
+    {
+        auto & v = view[ id ];
+
+        auto it = templs_.find( id );
+
+        if( it == templs_.end() )
+            continue;
+
+        v.name          = it->second.name;
+        v.category_id   = it->second.category_id;
+
+        for( auto & l : it->second.localized_templ_info )
+        {
+            if( replaced_keys.count( to_key( id, l.first ) ) == 0 )
+                v.localized_templ_info.insert( l );
+        }
+    }
+
+    for( auto & e : changes->changed_t )
+    {
+        view[ e.first.id ].name         = e.first.name;
+        view[ e.first.id ].category_id  = e.first.category_id;
+    }
+
+    for( auto & s : changes->changed_l )
+    {
+        LocalizedTemplateInfo info;
+
+        info.name   = s.e.name;
+        info.templ  = s.e.templ;
+        info.st     = s.st.get();
+
+        view[ s.e.id ].localized_templ_info.insert( MapLocaleToLocTemplInfo::value_type( s.e.locale, info ) );
+    }
+
+    std::vector<MapIdToTemplateInfo::value_type *> templs;
+
+    for( auto & e : view )
+        templs.push_back( & e );
+
+    for( auto & i : validate_templates( templs, changes->slots, changes->slot_names ) )
+        changes->issues[ i.id ].push_back( i );
+
+    changes->affected_ids.assign( ids.begin(), ids.end() );
+
+    for( auto & s : changes->changed_l )
+    {
+        s.estimated_size    = view[ s.e.id ].localized_templ_info[ s.e.locale ].estimated_size;
+
+        // the slot template was needed only for the validation, see release_uncompiled()
+        s.st.reset();
+
+        if( is_compressed_ )
+            std::string().swap( s.e.templ );
+    }
+}
+
+void TemplTextKeeper::apply_changes( Changes & changes )
+{
+    // insert the new elements first, so that the changes below cannot throw;
+    // if an insertion fails the inserted elements are erased again
+
+    std::vector<id_t>           new_ids;
+    std::vector<uint64_t>       new_keys;
+    std::vector<std::string>    new_names;
+    std::vector<uint64_t>       new_hashes;
+    std::vector<uint64_t>       new_blocks;
+    std::vector<id_t>           new_issue_ids;
+
+    std::set<std::string>       names;      // names of the changed general templates
+
+    try
+    {
+        for( auto & e : changes.changed_t )
+        {
+            if( templs_.insert( MapIdToTemplateInfo::value_type( e.first.id, TemplateInfo() ) ).second )
+                new_ids.push_back( e.first.id );
+
+            if( templ_names_.insert( MapTemplNameToTemplId::value_type( e.first.name, e.first.id ) ).second )
+                new_names.push_back( e.first.name );
+
+            names.insert( e.first.name );
+
+            LineKey k;
+
+            k.type      = 'T';
+            k.id        = e.first.id;
+            k.locale    = lang_tools::lang_e::UNDEF;
+
+            auto key = to_record_key( k );
+
+            if( line_hashes_.insert( MapKeyToLineHash::value_type( key, 0 ) ).second )
+                new_hashes.push_back( key );
+        }
+
+        for( auto & s : changes.changed_l )
+        {
+            auto & loc = templs_.find( s.e.id )->second.localized_templ_info;
+
+            auto key = to_key( s.e.id, s.e.locale );
+
+            if( loc.insert( MapLocaleToLocTemplInfo::value_type( s.e.locale, LocalizedTemplateInfo() ) ).second )
+                new_keys.push_back( key );
+
+            if( line_hashes_.insert( MapKeyToLineHash::value_type( key, 0 ) ).second )
+                new_hashes.push_back( key );
+        }
+
+        for( size_t i = 0; i < changes.new_blocks.size(); ++i )
+        {
+            auto hash = changes.new_blocks[i].hash;
+
+            auto b = blocks_.insert( MapHashToBlock::value_type( hash, Block() ) );
+
+            if( b.second )
+            {
+                b.first->second.count   = 0;
+                b.first->second.keys.swap( changes.new_block_keys[i] );
+
+                new_blocks.push_back( hash );
+            }
+        }
+
+        for( auto & e : changes.issues )
+        {
+            if( issues_.insert( MapIdToIssues::value_type( e.first, Issues() ) ).second )
+                new_issue_ids.push_back( e.first );
+        }
+    }
+    catch( std::exception & )
+    {
+        for( auto id : new_issue_ids )
+            issues_.erase( id );
+
+        for( auto hash : new_blocks )
+            blocks_.erase( hash );
+
+        for( auto key : new_hashes )
+            line_hashes_.erase( key );
+
+        for( auto & name : new_names )
+            templ_names_.erase( name );
+
+        for( auto key : new_keys )
+            templs_.find( to_id( key ) )->second.localized_templ_info.erase( to_locale( key ) );
+
+        for( auto id : new_ids )
+            templs_.erase( id );
+
+        throw;
+    }
+
+    // nothing below throws
+
+    // the hot table might point to removed templates, it's built again in update_derived()
+    hot_table_.store( nullptr, std::memory_order_release );
+
+    for( auto key : changes.removed_l )
+    {
+        auto & loc = templs_.find( to_id( key ) )->second.localized_templ_info;
+
+        auto it = loc.find( to_locale( key ) );
+
+        if( is_compressed_ && it->second.packed.empty() == false )
+        {
+            raw_size_       -= BodyCodec::get_raw_size( it->second.packed );
+            packed_size_    -= it->second.packed.size();
+        }
+
+        delete it->second.t;
+        delete it->second.st;
+
+        loc.erase( it );
+
+        line_hashes_.erase( key );
+    }
+
+    // names are released unless a changed template takes them over
+
+    auto release_name = [&]( id_t id, const std::string & name )
+    {
+        auto it = templ_names_.find( name );
+
+        if( it != templ_names_.end() && it->second == id && names.count( name ) == 0 )
+            templ_names_.erase( it );
+    };
+
+    for( auto id : changes.removed_t )
+    {
+        auto it = templs_.find( id );
+
+        release_name( id, it->second.name );
+
+        templs_.erase( it );
+
+        line_hashes_.erase( ( uint64_t( id ) << 32 ) | GENERAL_LOCALE );
+
+        issues_.erase( id );
+    }
+
+    for( auto & e : changes.changed_t )
+        release_name( e.first.id, templs_.find( e.first.id )->second.name );
+
+    for( auto & e : changes.changed_t )
+    {
+        auto & info = templs_.find( e.first.id )->second;
+
+        templ_names_.find( e.first.name )->second = e.first.id;
+
+        info.category_id    = e.first.category_id;
+        info.name.swap( e.first.name );
+
+        line_hashes_.find( ( uint64_t( e.first.id ) << 32 ) | GENERAL_LOCALE )->second = e.second;
+    }
+
+    for( auto & s : changes.changed_l )
+    {
+        auto & info = templs_.find( s.e.id )->second.localized_templ_info.find( s.e.locale )->second;
+
+        if( is_compressed_ && info.packed.empty() == false )
+        {
+            raw_size_       -= BodyCodec::get_raw_size( info.packed );
+            packed_size_    -= info.packed.size();
+        }
+
+        delete info.t;
+        delete info.st;
+
+        info.t      = s.t.release();
+        info.st     = s.st.release();
+        info.name.swap( s.e.name );
+        info.templ.swap( s.e.templ );
+        info.packed.swap( s.packed );
+        info.estimated_size = s.estimated_size;
+
+        // the slot template is built on first use
+        info.is_compiled.store( false, std::memory_order_release );
+
+        if( is_compressed_ )
+        {
+            raw_size_       += s.raw_size;
+            packed_size_    += info.packed.size();
+        }
+
+        line_hashes_.find( to_key( s.e.id, s.e.locale ) )->second = s.hash;
+    }
+
+    for( auto hash : changes.vanished_blocks )
+    {
+        auto it = blocks_.find( hash );
+
+        if( --it->second.count == 0 )
+            blocks_.erase( it );
+    }
+
+    for( auto & b : changes.new_blocks )
+        ++blocks_.find( b.hash )->second.count;
+
+    slots_.swap( changes.slots );
+    slot_names_.swap( changes.slot_names );
+
+    for( auto id : changes.affected_ids )
+    {
+        auto it     = issues_.find( id );
+        auto it_new = changes.issues.find( id );
+
+        if( it_new != changes.issues.end() )
+            it->second.swap( it_new->second );
+        else if( it != issues_.end() )
+            issues_.erase( it );
+    }
+}
+
+void TemplTextKeeper::update_derived( const Changes & changes )
+{
+    // the reload has succeeded at this point, so the derived structures are dropped instead of failing it
+
+    if( is_search_index_built_ )
+    {
+        try
+        {
+            std::vector<uint64_t> keys;
+
+            for( auto key : changes.removed_l )
+                search_index_.remove( to_id( key ), to_locale( key ) );
+
+            // name and category are part of the search index entries
+            for( auto & e : changes.changed_t )
+            {
+                for( auto & l : templs_.find( e.first.id )->second.localized_templ_info )
+                    keys.push_back( to_key( e.first.id, l.first ) );
+            }
+
+            for( auto & s : changes.changed_l )
+                keys.push_back( to_key( s.e.id, s.e.locale ) );
+
+            for( auto key : keys )
+            {
+                auto it = templs_.find( to_id( key ) );
+
+                SearchIndex::Entry entry;
+
+                entry.id            = it->first;
+                entry.category_id   = it->second.category_id;
+                entry.locale        = to_locale( key );
+
+                search_index_.add( entry, it->second.name, it->second.localized_templ_info.find( entry.locale )->second.name );
+            }
+        }
+        catch( std::exception & )
+        {
+            // built again on the next search
+            search_index_.clear();
+            is_search_index_built_ = false;
+        }
+    }
+
+    try
+    {
+        {
+            // no lookups run during reload(), so nothing scans the replaced tables
+            std::lock_guard<std::mutex> lock( profile_mutex_ );
+
+            hot_tables_.clear();
+        }
+
+        build_hot_table();
+    }
+    catch( std::exception & )
+    {
+        // lookups go to the main index only
+    }
+}
+
+void TemplTextKeeper::check_names( const std::vector<GeneralTemplate> & changed_t, const std::vector<id_t> & removed_t ) const
+{
+    std::set<id_t>          moved_ids( removed_t.begin(), removed_t.end() );
+    std::set<std::string>   names;
+
+    for( auto & e : changed_t )
+        moved_ids.insert( e.id );
+
+    for( auto & e : changed_t )
+    {
+        bool is_duplicate = ( names.insert( e.name ).second == false );
+
+        auto it = templ_names_.find( e.name );
+
+        // the name is taken by a template which keeps it
+        if( it != templ_names_.end() && it->second != e.id && moved_ids.count( it->second ) == 0 )
+            is_duplicate = true;
+
+        if( is_duplicate )
+            throw std::runtime_error( "duplicate template name '" + e.name + "', id " + std::to_string( e.id ) );
+    }
+}
+
+TemplTextKeeper::MappedFile::MappedFile( const std::string & filename ):
+        data_( nullptr ),
+        size_( 0 )
+{
+    // mapped instead of read, so that hashing the blocks is the only pass over the file
+
+    int fd = open( filename.c_str(), O_RDONLY );
+
+    if( fd == -1 )
+        throw std::runtime_error( "cannot open file " + filename );
+
+    struct stat st;
+
+    if( fstat( fd, & st ) != 0 )
+    {
+        close( fd );
+        throw std::runtime_error( "cannot stat file " + filename );
+    }
+
+    if( st.st_size > 0 )
+    {
+        auto addr = mmap( nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+
+        if( addr == MAP_FAILED )
+        {
+            close( fd );
+            throw std::runtime_error( "cannot map file " + filename );
+        }
+
+        data_   = static_cast<const char *>( addr );
+        size_   = st.st_size;
+    }
+
+    close( fd );
+}
+
+TemplTextKeeper::MappedFile::~MappedFile()
+{
+    if( data_ )
+        munmap( const_cast<char *>( data_ ), size_ );
+}
+
+const char * TemplTextKeeper::MappedFile::get_data() const
+{
+    return data_;
+}
+
+size_t TemplTextKeeper::MappedFile::get_size() const
+{
+    return size_;
+}
+
+void TemplTextKeeper::split_blocks( const MappedFile & file, std::vector<BlockRef> * blocks )
+{
+    // a block ends after a line whose hash has the BLOCK_MASK bits zero, so an edit shifts
+    // only the boundaries around it and the other blocks keep their hashes
+
+    auto data   = file.get_data();
+    auto end    = file.get_size();
+
+    BlockRef block;
+
+    block.hash  = 0;
+    block.begin = 0;
+
+    uint32_t num_lines = 0;
+
+    size_t pos = 0;
+
+    while( pos < end )
+    {
+        auto p      = data + pos;
+        auto eol    = static_cast<const char *>( memchr( p, '\n', end - pos ) );
+        auto size   = eol ? size_t( eol - p ) : end - pos;
+
+        auto h = hash_bytes( p, size );
+
+        block.hash  = ( block.hash ^ h ) * 0x9E3779B97F4A7C15ULL;
+        block.hash  ^= block.hash >> 29;
+
+        pos = std::min( pos + size + 1, end );
+
+        if( ( h & BLOCK_MASK ) == 0 || ++num_lines == MAX_BLOCK_LINES || pos == end )
+        {
+            block.end   = pos;
+
+            blocks->push_back( block );
+
+            block.hash  = 0;
+            block.begin = pos;
+
+            num_lines   = 0;
+        }
+    }
+}
+
+void TemplTextKeeper::get_lines( const MappedFile & file, const BlockRef & block, std::vector<Line> * lines )
+{
+    // returns the records only, like utils::read_config_file() skips empty lines and comments
+
+    lines->clear();
+
+    size_t pos = block.begin;
+
+    while( pos < block.end )
+    {
+        auto p      = file.get_data() + pos;
+        auto eol    = static_cast<const char *>( memchr( p, '\n', block.end - pos ) );
+
+        Line line;
+
+        line.begin  = pos;
+        line.size   = eol ? size_t( eol - p ) : block.end - pos;
+
+        pos += line.size + 1;
+
+        if( line.size == 0 || * p == '#' )
+            continue;
+
+        line.hash   = hash_bytes( p, line.size );
+
+        lines->push_back( line );
+    }
+}
+
+uint64_t TemplTextKeeper::hash_bytes( const char * p, size_t size )
+{
+    // multiply-xorshift over 8-byte words, every step is invertible, so two lines
+    // of the same length that differ in one word never collide
+
+    static const uint64_t K = 0x9E3779B97F4A7C15ULL;
+
+    uint64_t res = size * K;
+
+    for( ; size >= 8; p += 8, size -= 8 )
+    {
+        uint64_t v;
+
+        memcpy( & v, p, 8 );
+
+        res = ( res ^ v ) * K;
+        res ^= res >> 29;
+    }
+
+    uint64_t v = 0;
+
+    memcpy( & v, p, size );
+
+    res = ( res ^ v ) * K;
+    res ^= res >> 32;
+
+    return res;
+}
+
+TemplTextKeeper::LineKey TemplTextKeeper::to_line_key( const std::string & l )
+{
+    // parses only the key fields: T;1;... or L;1;de;...
+
+    if( l.empty() )
+        throw std::runtime_error( "parse_line: invalid entry - empty line" );
+
+    if( l[0] != 'T' && l[0] != 'L' )
+        throw std::runtime_error( "parse_line: invalid entry " + l );
+
+    LineKey res;
+
+    res.type    = l[0];
+    res.locale  = lang_tools::lang_e::UNDEF;
+
+    auto p1 = l.find( ';' );
+    auto p2 = ( p1 == std::string::npos ) ? p1 : l.find( ';', p1 + 1 );
+
+    if( p2 == std::string::npos )
+        throw std::runtime_error( "invalid entry: " + l );
+
+    try
+    {
+        res.id  = std::stoi( l.substr( p1 + 1, p2 - p1 - 1 ) );
+
+        if( res.type == 'L' )
+        {
+            auto p3 = l.find( ';', p2 + 1 );
+
+            if( p3 == std::string::npos )
+                throw std::runtime_error( "invalid entry: " + l );
+
+            res.locale  = lang_tools::to_lang_iso( l.substr( p2 + 1, p3 - p2 - 1 ) );
+        }
+    }
+    catch( std::exception & e )
+    {
+        throw std::runtime_error( "invalid entry: " + l );
+    }
+
+    return res;
+}
+
+uint64_t TemplTextKeeper::to_record_key( const LineKey & k )
+{
+    if( k.type == 'T' )
+        return ( uint64_t( k.id ) << 32 ) | GENERAL_LOCALE;
+
+    return to_key( k.id, k.locale );
+}
+
+bool TemplTextKeeper::get_file_stamp( const std::string & filename, FileStamp * stamp )
+{
+    struct stat st;
+
+    if( stat( filename.c_str(), & st ) != 0 )
+    {
+        stamp->size         = 0;
+        stamp->mtime_sec    = 0;
+        stamp->mtime_nsec   = 0;
+
+        return false;
+    }
+
+    stamp->size         = st.st_size;
+    stamp->mtime_sec    = st.st_mtim.tv_sec;
+    stamp->mtime_nsec   = st.st_mtim.tv_nsec;
+
+    return true;
+}
+
+bool TemplTextKeeper::FileStamp::operator==( const FileStamp & r ) const
+{
+    return size == r.size && mtime_sec == r.mtime_sec && mtime_nsec == r.mtime_nsec;
+}
+
+void TemplTextKeeper::process_line( const std::string & line )
+{
+    if( line.empty() )
+        throw std::runtime_error( "parse_line: invalid entry - empty line" );
+
+    if( line[0] == 'T' )
+    {
+        process_line_t( line );
+    }
+    else if( line[0] == 'L' )
+    {
+        process_line_l( line );
+    }
+    else
+    {
+        throw std::runtime_error( "parse_line: invalid entry " + line );
+    }
+}
+
+void TemplTextKeeper::process_line_t( const std::string & line )
+{
+    auto e = to_general_templ( line );
+
+    TemplateInfo info;
+
+    info.category_id    = e.category_id;
+    info.name           = e.name;
+
+    auto b = templs_.insert( MapIdToTemplateInfo::value_type( e.id, info ) ).second;
+
+    if( b == false )
+    {
+        throw std::runtime_error( "duplicate template id " + std::to_string( e.id ) );
+    }
+
+    b = templ_names_.insert( MapTemplNameToTemplId::value_type( e.name, e.id ) ).second;
+
+    if( b == false )
+    {
+        throw std::runtime_error( "duplicate template name '" + e.name + "', id " + std::to_string( e.id ) );
+    }
+}
+
+void TemplTextKeeper::process_line_l( const std::string & line )
+{
+    auto e = to_localized_templ( line );
+
+    auto it = templs_.find( e.id );
+
+    if( it == templs_.end() )
+    {
+        throw std::runtime_error( "cannot find template id " + std::to_string( e.id ) );
+    }
+
+    auto & info = it->second;
+
+    LocalizedTemplateInfo loc_info;
+
+    loc_info.name   = e.name;
+    loc_info.templ  = e.templ;
+    loc_info.t      = nullptr;      // see compile_templates()
+    loc_info.st     = nullptr;
+    loc_info.estimated_size = 0;    // see validate_templates()
+
+    auto b = info.localized_templ_info.insert( MapLocaleToLocTemplInfo::value_type( e.locale, loc_info ) ).second;
+
+    if( b == false )
+    {
+        throw std::runtime_error( "template " + std::to_string( e.id ) + " has already locale " + lang_tools::to_string_iso( e.locale ) );
+    }
+}
+
+TemplTextKeeper::GeneralTemplate TemplTextKeeper::to_general_templ( const std::string & l )
+{
+    // format: T;1;17;Say;
+    GeneralTemplate res;
+
+    std::vector< std::string > elems;
+    tokenize_to_vector( elems, l, ";" );
+
+    if( elems.size() < 4 )
+        throw std::runtime_error( "not enough arguments (<4) in entry: " + l  );
+
+    try
+    {
+        res.id          = std::stoi( elems[1] );
+        res.category_id = std::stoi( elems[2] );
+        res.name        = elems[3];
+    }
+    catch( std::exception & e )
+    {
+        throw std::runtime_error( "invalid entry: " + l );
+    }
+
+    return res;
+}
+
+TemplTextKeeper::LocalizedTemplate TemplTextKeeper::to_localized_templ( const std::string & l )
+{
+    // format: L;1;de;Sagen;%TEXT.
+    LocalizedTemplate res;
+
+    std::vector< std::string > elems;
+    tokenize_to_vector( elems, l, ";" );
+
+    if( elems.size() < 5 )
+        throw std::runtime_error( "not enough arguments (<5) in entry: " + l  );
+
+    try
+    {
+        res.id          = std::stoi( elems[1] );
+        res.locale      = lang_tools::to_lang_iso( elems[2] );
+        res.name        = elems[3];
+        res.templ       = elems[4];
+    }
+    catch( std::exception & e )
+    {
+        throw std::runtime_error( "invalid entry: " + l );
+    }
+
+    return res;
+}
+
+void TemplTextKeeper::parse_file( const MappedFile & file )
+{
+    std::vector<BlockRef>   blocks;
+    std::vector<Line>       lines;
+
+    split_blocks( file, & blocks );
+
+    for( auto & b : blocks )
+    {
+        auto & block = blocks_[ b.hash ];
+
+        ++block.count;
+
+        get_lines( file, b, & lines );
+
+        for( auto & line : lines )
+        {
+            std::string l( file.get_data() + line.begin, line.size );
+
+            process_line( l );
+
+            auto key = to_record_key( to_line_key( l ) );
+
+            line_hashes_[ key ] = line.hash;
+
+            // repeated blocks can contain only comments, their records would be duplicates
+            if( block.count == 1 )
+                block.keys.push_back( key );
+        }
+    }
+}
+
+void TemplTextKeeper::compile_templates()
+{
+    // the hottest templates are compiled first, so that they are allocated close to each other
+
+    for( auto key : get_hot_keys( get_access_counts(), HOT_TABLE_SIZE ) )
+    {
+        auto info = find_localized_templ( to_id( key ), to_locale( key ) );
+
+        if( info && info->t == nullptr )
+            compile( * info, get_body( * info ), slots_ );
+    }
+
+    for( auto & e : templs_ )
+    {
+        for( auto & l : e.second.localized_templ_info )
+        {
+            if( l.second.t )
+                continue;
+
+            // interns the placeholders, kept only for the validation, see release_uncompiled()
+            l.second.st = new SlotTempl( l.second.templ, slots_ );
+
+            // with compressed bodies Templ is compiled on first use
+            if( is_compressed_ == false )
+                l.second.t  = new Templ( l.second.templ, l.second.name );
+        }
+    }
+
+    update_slot_names();
+}
+
+void TemplTextKeeper::update_slot_names()
+{
+    slot_names_.resize( slots_.size() );
+
+    for( auto & s : slots_ )
+        slot_names_[ s.second ] = s.first;
+}
+
+void TemplTextKeeper::compile( const LocalizedTemplateInfo & info, const std::string & body, SlotTempl::MapNameToSlot & registry )
+{
+    info.st     = new SlotTempl( body, registry );
+    info.t      = new Templ( body, info.name );
+
+    info.is_compiled.store( true, std::memory_order_release );
+}
+
+void TemplTextKeeper::compress_bodies()
+{
+    std::vector<std::string> bodies;
+
+    for( auto & e : templs_ )
+    {
+        for( auto & l : e.second.localized_templ_info )
+            bodies.push_back( std::move( l.second.templ ) );
+    }
+
+    codec_ = BodyCodec( BodyCodec::train_dictionary( bodies ) );
+
+    raw_size_       = 0;
+    packed_size_    = 0;
+
+    unsigned i = 0;
+
+    for( auto & e : templs_ )
+    {
+        for( auto & l : e.second.localized_templ_info )
+        {
+            auto & body = bodies[i++];
+
+            l.second.packed = codec_.compress( body );
+            l.second.templ  = std::string();
+
+            raw_size_       += body.size();
+            packed_size_    += l.second.packed.size();
+
+            std::string().swap( body );
+        }
+    }
+}
+
+void TemplTextKeeper::ensure_search_index() const
+{
+    if( is_search_index_built_.load( std::memory_order_acquire ) )
+        return;
+
+    std::lock_guard<std::mutex> lock( search_index_mutex_ );
+
+    if( is_search_index_built_.load( std::memory_order_relaxed ) )
+        return;
+
+    build_search_index();
+
+    is_search_index_built_.store( true, std::memory_order_release );
+}
+
+void TemplTextKeeper::build_search_index() const
+{
+    search_index_.clear();
+
+    for( auto & e : templs_ )
+    {
+        for( auto & l : e.second.localized_templ_info )
+        {
+            SearchIndex::Entry entry;
+
+            entry.id            = e.first;
+            entry.category_id   = e.second.category_id;
+            entry.locale        = l.first;
+
+            search_index_.add( entry, e.second.name, l.second.name );
+        }
+    }
+
+    search_index_.finalize();
+}
+
+void TemplTextKeeper::build_hot_table()
+{
+    // built aside, so that a concurrent lookup sees either the previous or the new table
+
+    std::unique_ptr<HotTable> table( new HotTable );
+
+    for( auto key : get_hot_keys( get_access_counts(), HOT_TABLE_SIZE ) )
+    {
+        auto info = find_localized_templ( to_id( key ), to_locale( key ) );
+
+        if( info == nullptr )
+            continue;
+
+        table->keys.push_back( key );
+        table->templs.push_back( info );
+    }
+
+    std::lock_guard<std::mutex> lock( profile_mutex_ );
+
+    // the previous table is kept, a lookup may still be scanning it
+    hot_tables_.push_back( std::move( table ) );
+
+    hot_table_.store( hot_tables_.back().get(), std::memory_order_release );
+}
+
+TemplTextKeeper::MapKeyToCount TemplTextKeeper::get_access_counts() const
+{
+    std::lock_guard<std::mutex> lock( profile_mutex_ );
+
+    MapKeyToCount res = profile_;
+
+    for( auto & c : access_counts_ )
+        res[ c.first ] += c.second;
+
+    return res;
+}
+
+std::vector<uint64_t> TemplTextKeeper::get_hot_keys( const MapKeyToCount & counts, uint32_t max_size )
+{
+    std::vector<std::pair<uint32_t, uint64_t>> sorted;     // count --> key
+
+    for( auto & c : counts )
+        sorted.push_back( std::make_pair( c.second, c.first ) );
+
+    std::sort( sorted.begin(), sorted.end(),
+            []( const std::pair<uint32_t, uint64_t> & a, const std::pair<uint32_t, uint64_t> & b )
+            {
+                return a.first > b.first || ( a.first == b.first && a.second < b.second );
+            } );
+
+    if( sorted.size() > max_size )
+        sorted.resize( max_size );
+
+    std::vector<uint64_t> res;
+
+    for( auto & s : sorted )
+        res.push_back( s.second );
+
+    return res;
+}
+
+void TemplTextKeeper::set_access_sampling( uint32_t rate )
+{
+    sampling_rate_.store( rate, std::memory_order_relaxed );
+}
+
+void TemplTextKeeper::sample_access( id_t id, lang_tools::lang_e locale, uint32_t rate ) const
+{
+    thread_local uint32_t tick = 0;
+
+    if( ++tick < rate )
+        return;
+
+    tick = 0;
+
+    std::lock_guard<std::mutex> lock( profile_mutex_ );
+
+    ++access_counts_[ to_key( id, locale ) ];
+}
+
+bool TemplTextKeeper::save_profile( const std::string & profile_file ) const
+{
+    // format: P;1;en;1234
+
+    std::ofstream os( profile_file );
+
+    if( os.is_open() == false )
+        return false;
+
+    auto counts = get_access_counts();
+
+    for( auto key : get_hot_keys( counts, counts.size() ) )
+    {
+        os << "P;" << to_id( key ) << ";" << lang_tools::to_string_iso( to_locale( key ) ) << ";" << counts.at( key ) << "\n";
+    }
+
+    return os.good();
+}
+
+bool TemplTextKeeper::load_profile( const std::string & profile_file )
+{
+    if( std::ifstream( profile_file ).is_open() == false )
+        return false;
+
+    std::vector<std::string> lines;
+
+    MapKeyToCount profile;
+
+    try
+    {
+        utils::read_config_file( profile_file, lines );
+
+        for( auto & l : lines )
+        {
+            std::vector< std::string > elems;
+            tokenize_to_vector( elems, l, ";" );
+
+            if( elems.size() < 4 || elems[0] != "P" )
+                return false;
+
+            auto id         = std::stoi( elems[1] );
+            auto locale     = lang_tools::to_lang_iso( elems[2] );
+            auto count      = std::stoul( elems[3] );
+
+            profile[ to_key( id, locale ) ] += count;
+        }
+    }
+    catch( std::exception & )
+    {
+        return false;
+    }
+
     {
-        std::vector<std::string> lines;
+        std::lock_guard<std::mutex> lock( profile_mutex_ );
 
-        utils::read_config_file( config_file, lines );
-
-        parse_lines( lines );
-    }
-    catch( std::exception & e )
-    {
-        throw e;
+        profile_.swap( profile );
     }
 
+    build_hot_table();
+
     return true;
 }
 
-void TemplTextKeeper::process_line( const std::string & line )
+uint64_t TemplTextKeeper::to_key( id_t id, lang_tools::lang_e locale )
 {
-    if( line.empty() )
-        throw std::runtime_error( "parse_line: invalid entry - empty line" );
+    return ( uint64_t( id ) << 32 ) | static_cast<uint32_t>( locale );
+}
 
-    if( line[0] == 'T' )
-    {
-        process_line_t( line );
-    }
-    else if( line[0] == 'L' )
-    {
-        process_line_l( line );
-    }
-    else
-    {
-        throw std::runtime_error( "parse_line: invalid entry " + line );
-    }
+id_t TemplTextKeeper::to_id( uint64_t key )
+{
+    return static_cast<id_t>( key >> 32 );
 }
 
-void TemplTextKeeper::process_line_t( const std::string & line )
+lang_tools::lang_e TemplTextKeeper::to_locale( uint64_t key )
 {
-    auto e = to_general_templ( line );
+    return static_cast<lang_tools::lang_e>( key & 0xFFFFFFFF );
+}
 
-    TemplateInfo info;
+void TemplTextKeeper::set_known_functions( const std::set<std::string> & names )
+{
+    known_functions_    = names;
+}
 
-    info.category_id    = e.category_id;
-    info.name           = e.name;
+TemplTextKeeper::Issues TemplTextKeeper::validate_templates(
+        const std::vector<MapIdToTemplateInfo::value_type *> & templs,
+        const SlotTempl::MapNameToSlot  & registry,
+        const std::vector<std::string>  & slot_names ) const
+{
+    Linter linter( known_functions_ );
 
-    auto b = templs_.insert( MapIdToTemplateInfo::value_type( e.id, info ) ).second;
+    unsigned num_threads = std::max( 1u, std::thread::hardware_concurrency() );
 
-    if( b == false )
+    num_threads = std::min<unsigned>( num_threads, templs.size() / MIN_TEMPLS_PER_THREAD + 1 );
+
+    // every thread writes only to its own templates and issues
+
+    std::vector<Issues> issues( num_threads );
+
+    auto validate_part = [&]( unsigned n )
     {
-        throw std::runtime_error( "duplicate template id " + std::to_string( e.id ) );
-    }
+        for( size_t i = n; i < templs.size(); i += num_threads )
+        {
+            auto & e = * templs[i];
 
-    b = templ_names_.insert( MapTemplNameToTemplId::value_type( e.name, e.id ) ).second;
+            try
+            {
+                auto res = validate_template( e.first, e.second, linter, registry, slot_names );
 
-    if( b == false )
+                issues[n].insert( issues[n].end(), res.begin(), res.end() );
+            }
+            catch( std::exception & ex )
+            {
+                Issue issue;
+
+                issue.id        = e.first;
+                issue.locale    = lang_tools::lang_e::UNDEF;
+                issue.message   = std::string( "cannot validate: " ) + ex.what();
+
+                issues[n].push_back( issue );
+            }
+        }
+    };
+
+    // an exception must not leave a thread, it is rethrown after all are joined
+
+    std::vector<std::exception_ptr> errors( num_threads );
+
+    auto worker = [&]( unsigned n )
     {
-        throw std::runtime_error( "duplicate template name '" + e.name + "', id " + std::to_string( e.id ) );
-    }
-}
+        try
+        {
+            validate_part( n );
+        }
+        catch( ... )
+        {
+            errors[n] = std::current_exception();
+        }
+    };
 
-void TemplTextKeeper::process_line_l( const std::string & line )
-{
-    auto e = to_localized_templ( line );
+    std::vector<std::thread> threads;
 
-    auto it = templs_.find( e.id );
+    threads.reserve( num_threads ); // push_back() must not throw once a thread runs
 
-    if( it == templs_.end() )
+    try
     {
-        throw std::runtime_error( "cannot find template id " + std::to_string( e.id ) );
+        for( unsigned n = 1; n < num_threads; ++n )
+            threads.push_back( std::thread( worker, n ) );
+    }
+    catch( std::system_error & )
+    {
+        // out of threads: the workers not started run on the calling thread
     }
 
-    auto & info = it->second;
-
-    LocalizedTemplateInfo loc_info;
+    for( unsigned n = threads.size() + 1; n < num_threads; ++n )
+        worker( n );
 
-    loc_info.name   = e.name;
-    loc_info.templ  = e.templ;
-    loc_info.t      = new Templ( e.templ, e.name );
+    worker( 0 );
 
-    auto b = info.localized_templ_info.insert( MapLocaleToLocTemplInfo::value_type( e.locale, loc_info ) ).second;
+    for( auto & t : threads )
+        t.join();
 
-    if( b == false )
+    for( auto & e : errors )
     {
-        throw std::runtime_error( "template " + std::to_string( e.id ) + " has already locale " + lang_tools::to_string_iso( e.locale ) );
+        if( e )
+            std::rethrow_exception( e );
     }
+
+    Issues res;
+
+    for( auto & v : issues )
+        res.insert( res.end(), v.begin(), v.end() );
+
+    return res;
 }
 
-TemplTextKeeper::GeneralTemplate TemplTextKeeper::to_general_templ( const std::string & l )
+TemplTextKeeper::Issues TemplTextKeeper::validate_template(
+        id_t                            id,
+        TemplateInfo                    & info,
+        const Linter                    & linter,
+        const SlotTempl::MapNameToSlot  & registry,
+        const std::vector<std::string>  & slot_names ) const
 {
-    // format: T;1;17;Say;
-    GeneralTemplate res;
+    Issues res;
 
-    std::vector< std::string > elems;
-    tokenize_to_vector( elems, l, ";" );
+    auto add_issue = [&]( lang_tools::lang_e locale, const std::string & message )
+    {
+        Issue issue;
 
-    if( elems.size() < 4 )
-        throw std::runtime_error( "not enough arguments (<4) in entry: " + l  );
+        issue.id        = id;
+        issue.locale    = locale;
+        issue.message   = message;
 
-    try
+        res.push_back( issue );
+    };
+
+    auto & loc = info.localized_templ_info;
+
+    if( loc.empty() )
+        add_issue( lang_tools::lang_e::UNDEF, "template '" + info.name + "' has no localized versions" );
+
+    std::map<lang_tools::lang_e, std::set<slot_t>> placeholders;
+
+    std::set<slot_t> all_placeholders;
+
+    for( auto & l : loc )
     {
-        res.id          = std::stoi( elems[1] );
-        res.category_id = std::stoi( elems[2] );
-        res.name        = elems[3];
+        // compiled at load, except for unchanged bodies in compressed mode on reload
+
+        std::unique_ptr<SlotTempl> temp;
+
+        auto st = l.second.st;
+
+        if( st == nullptr )
+        {
+            // the registry is const, so the worker threads don't modify it
+            temp.reset( new SlotTempl( get_body( l.second ), registry ) );
+            st = temp.get();
+        }
+
+        for( auto & e : linter.check( * st ) )
+            add_issue( l.first, e );
+
+        l.second.estimated_size = st->get_literal_size() + AVG_ARG_SIZE * st->get_slots().size();
+
+        auto & slots = st->get_slots();
+
+        all_placeholders.insert( slots.begin(), slots.end() );
+
+        placeholders[ l.first ].insert( slots.begin(), slots.end() );
     }
-    catch( std::exception & e )
+
+    for( auto & p : placeholders )
     {
-        throw std::runtime_error( "invalid entry: " + l );
+        std::string missing;
+
+        for( auto slot : all_placeholders )
+        {
+            if( p.second.count( slot ) == 0 )
+                missing += ( missing.empty() ? "" : ", " ) + slot_names[ slot ];
+        }
+
+        if( missing.empty() == false )
+            add_issue( p.first, "placeholders used in other locales are missing: " + missing );
     }
 
     return res;
 }
 
-TemplTextKeeper::LocalizedTemplate TemplTextKeeper::to_localized_templ( const std::string & l )
+TemplTextKeeper::Issues TemplTextKeeper::get_issues() const
 {
-    // format: L;1;de;Sagen;%TEXT.
-    LocalizedTemplate res;
+    Issues res;
 
-    std::vector< std::string > elems;
-    tokenize_to_vector( elems, l, ";" );
+    for( auto & e : issues_ )
+        res.insert( res.end(), e.second.begin(), e.second.end() );
 
-    if( elems.size() < 5 )
-        throw std::runtime_error( "not enough arguments (<5) in entry: " + l  );
+    return res;
+}
 
-    try
+TemplTextKeeper::CompressionStats TemplTextKeeper::get_compression_stats() const
+{
+    CompressionStats res;
+
+    res.raw_size    = raw_size_;
+    res.packed_size = packed_size_;
+    res.dict_size   = codec_.get_dictionary().size();
+
+    return res;
+}
+
+void TemplTextKeeper::release_uncompiled( LocalizedTemplateInfo & info )
+{
+    // the slot template was needed only for the validation, it's built again on first use,
+    // so that plain bodies are not held both as Templ and as SlotTempl segments
+
+    if( info.is_compiled.load( std::memory_order_relaxed ) == false )
     {
-        res.id          = std::stoi( elems[1] );
-        res.locale      = lang_tools::to_lang_iso( elems[2] );
-        res.name        = elems[3];
-        res.templ       = elems[4];
+        delete info.st;
+        info.st = nullptr;
     }
-    catch( std::exception & e )
+}
+
+std::string TemplTextKeeper::get_body( const LocalizedTemplateInfo & info ) const
+{
+    if( is_compressed_ && info.packed.empty() == false )
+        return codec_.decompress( info.packed );
+
+    return info.templ;
+}
+
+const TemplTextKeeper::LocalizedTemplateInfo * TemplTextKeeper::find_compiled_templ( id_t id, lang_tools::lang_e locale ) const
+{
+    auto info = find_localized_templ( id, locale );
+
+    auto rate = sampling_rate_.load( std::memory_order_relaxed );
+
+    // only existing templates are counted, so that probing doesn't grow the counts
+    if( rate && info )
+        sample_access( id, locale, rate );
+
+    // compiled templates are published by is_compiled, the lock is only taken to compile
+
+    if( info == nullptr || info->is_compiled.load( std::memory_order_acquire ) )
+        return info;
+
+    std::lock_guard<std::mutex> lock( mutex_ );
+
+    if( info->is_compiled.load( std::memory_order_relaxed ) == false )
     {
-        throw std::runtime_error( "invalid entry: " + l );
+        auto body = get_body( * info );
+
+        // all placeholders were interned at load
+        if( info->st == nullptr )
+            info->st    = new SlotTempl( body, slots_ );
+
+        // plain bodies are compiled into Templ at load
+        if( info->t == nullptr )
+            info->t     = new Templ( body, info->name );
+
+        info->is_compiled.store( true, std::memory_order_release );
     }
 
-    return res;
+    return info;
 }
 
-void TemplTextKeeper::parse_lines( const std::vector<std::string> & lines )
+const TemplTextKeeper::LocalizedTemplateInfo * TemplTextKeeper::find_localized_templ( id_t id, lang_tools::lang_e locale ) const
 {
-    for( auto & l : lines )
+    auto table = hot_table_.load( std::memory_order_acquire );
+
+    if( table )
     {
-        process_line( l );
+        auto key = to_key( id, locale );
+
+        for( size_t i = 0; i < table->keys.size(); ++i )
+        {
+            if( table->keys[i] == key )
+                return table->templs[i];
+        }
     }
+
+    auto it = templs_.find( id );
+
+    if( it == templs_.end() )
+        return nullptr;
+
+    auto it2 = it->second.localized_templ_info.find( locale );
+
+    if( it2 == it->second.localized_templ_info.end() )
+        return nullptr;
+
+    return & it2->second;
 }
 
 bool TemplTextKeeper::has_template( id_t id, lang_tools::lang_e locale ) const
@@ -216,17 +1684,12 @@ bool TemplTextKeeper::has_template( id_t id, lang_tools::lang_e locale ) const
 
 const TemplTextKeeper::Templ * TemplTextKeeper::get_template( id_t id, lang_tools::lang_e locale ) const
 {
-    auto it = templs_.find( id );
-
-    if( it == templs_.end() )
-        return nullptr;
+    auto info = find_compiled_templ( id, locale );
 
-    auto it2 = it->second.localized_templ_info.find( locale );
-
-    if( it2 == it->second.localized_templ_info.end() )
+    if( info == nullptr )
         return nullptr;
 
-    return it2->second.t;
+    return info->t;
 }
 
 const id_t TemplTextKeeper::find_template_id_by_name( const std::string & name ) const
@@ -239,6 +1702,104 @@ const id_t TemplTextKeeper::find_template_id_by_name( const std::string & name )
     return it->second;
 }
 
+slot_t TemplTextKeeper::get_slot( const std::string & placeholder ) const
+{
+    auto it = slots_.find( placeholder );
+
+    if( it == slots_.end() )
+        return SlotTempl::INVALID_SLOT;
+
+    return it->second;
+}
+
+uint32_t TemplTextKeeper::get_slot_count() const
+{
+    return slot_names_.size();
+}
+
+const SlotTempl * TemplTextKeeper::get_slot_template( id_t id, lang_tools::lang_e locale ) const
+{
+    auto info = find_compiled_templ( id, locale );
+
+    if( info == nullptr )
+        return nullptr;
+
+    return info->st;
+}
+
+std::string TemplTextKeeper::format(
+        id_t                id,
+        lang_tools::lang_e  locale,
+        const Args          & args,
+        bool                throw_on_error ) const
+{
+    auto info = find_compiled_templ( id, locale );
+
+    if( info == nullptr )
+        throw std::runtime_error( "cannot find template " + std::to_string( id ) + " " + lang_tools::to_string_iso( locale ) );
+
+    if( info->st->has_functions() == false )
+    {
+        // with all the arguments at hand no checks are needed
+        if( args.size() >= info->st->get_required_args() )
+            return info->st->format_unchecked( args, info->estimated_size );
+
+        return info->st->format( args, throw_on_error );
+    }
+
+    // functions are expanded by templtext only, so fall back to the name-based formatting
+
+    Templ::MapKeyValue tokens;
+
+    for( auto s : info->st->get_slots() )
+    {
+        if( s < args.size() )
+            tokens[ slot_names_[ s ] ] = args[ s ];
+    }
+
+    return info->t->format( tokens, throw_on_error );
+}
+
+std::string TemplTextKeeper::format(
+        id_t                        id,
+        lang_tools::lang_e          locale,
+        const Templ::MapKeyValue    & tokens,
+        bool                        throw_on_error ) const
+{
+    auto info = find_compiled_templ( id, locale );
+
+    if( info == nullptr )
+        throw std::runtime_error( "cannot find template " + std::to_string( id ) + " " + lang_tools::to_string_iso( locale ) );
+
+    if( info->st->has_functions() )
+        return info->t->format( tokens, throw_on_error );
+
+    // arguments are indexed by the template's own slots, not by the catalog-wide ones
+
+    auto & slots = info->st->get_slots();
+
+    Args args( slots.size() );
+
+    for( size_t i = 0; i < slots.size(); ++i )
+    {
+        auto & name = slot_names_[ slots[i] ];
+
+        auto it = tokens.find( name );
+
+        if( it == tokens.end() )
+        {
+            if( throw_on_error )
+                throw std::runtime_error( "missing token '" + name + "' in template " + std::to_string( id ) );
+
+            continue;
+        }
+
+        args[i] = it->second;
+    }
+
+    return info->st->format_local( args, info->estimated_size );
+}
+
 TemplTextKeeper::Records TemplTextKeeper::find_templates(
         uint32_t            * total_size,
         category_id_t       category_id,
@@ -270,17 +1831,7 @@ TemplTextKeeper::Records TemplTextKeeper::find_templates(
                 // return only those elements, which belong to the desired page
                 if( i >= offset && i < offset_end )
                 {
-                    Record r;
-
-                    r.id                = t.first;
-                    r.category_id       = t.second.category_id;
-                    r.name              = t.second.name;
-
-                    r.locale            = l.first;
-                    r.localized_name    = l.second.name;
-                    r.templ             = l.second.templ;
-
-                    res.push_back( r );
+                    res.push_back( to_record( t, l ) );
                 }
 
                 i++;
@@ -293,6 +1844,52 @@ TemplTextKeeper::Records TemplTextKeeper::find_templates(
     return res;
 }
 
+TemplTextKeeper::Records TemplTextKeeper::search_templates(
+        const std::string   & query,
+        category_id_t       category_id,
+        lang_tools::lang_e  locale,
+        uint32_t            max_results,
+        uint32_t            max_distance ) const
+{
+    TemplTextKeeper::Records res;
+
+    ensure_search_index();
+
+    auto entries = search_index_.search( query, category_id, locale, max_results, max_distance );
+
+    for( auto & e : entries )
+    {
+        auto it = templs_.find( e.id );
+
+        if( it == templs_.end() )
+            continue;
+
+        auto it2 = it->second.localized_templ_info.find( e.locale );
+
+        if( it2 == it->second.localized_templ_info.end() )
+            continue;
+
+        res.push_back( to_record( * it, * it2 ) );
+    }
+
+    return res;
+}
+
+TemplTextKeeper::Record TemplTextKeeper::to_record( const MapIdToTemplateInfo::value_type & t, const MapLocaleToLocTemplInfo::value_type & l ) const
+{
+    Record r;
+
+    r.id                = t.first;
+    r.category_id       = t.second.category_id;
+    r.name              = t.second.name;
+
+    r.locale            = l.first;
+    r.localized_name    = l.second.name;
+    r.templ             = get_body( l.second );
+
+    return r;
+}
+
 bool TemplTextKeeper::is_match( const TemplateInfo & c, category_id_t category_id )
 {
     if( category_id != 0 && category_id != c.category_id )
@@ -26,12 +26,22 @@ along with this program. If not, see <http://www.gnu.org/licenses/>.
 
 #include <string>                   // std::string
 #include <map>                      // std::map
+#include <set>                      // std::set
+#include <unordered_map>            // std::unordered_map
 #include <limits>                   // std::numeric_limits
+#include <vector>                   // std::vector
+#include <mutex>                    // std::mutex
+#include <atomic>                   // std::atomic
+#include <memory>                   // std::unique_ptr
 
 #include "templtext/templ.h"        // Templ
 #include "lang_tools/language_enum.h"    // lang_tools::lang_e
 
 #include "types.h"                  // id_t
+#include "slot_templ.h"             // SlotTempl
+#include "body_codec.h"             // BodyCodec
+#include "search_index.h"           // SearchIndex
+#include "linter.h"                 // Linter
 
 NAMESPACE_TEMPLTEXTKEEPER_START
 
@@ -52,13 +62,88 @@ public:
 
     typedef std::vector<Record> Records;
 
+    typedef SlotTempl::Args     Args;
+
+    struct Issue
+    {
+        id_t                id;
+        lang_tools::lang_e  locale;     // UNDEF for issues of the general template
+        std::string         message;
+    };
+
+    typedef std::vector<Issue> Issues;
+
+    struct CompressionStats
+    {
+        uint64_t    raw_size;       // total size of localized bodies
+        uint64_t    packed_size;    // total size of compressed bodies
+        uint32_t    dict_size;
+    };
+
 public:
 
     TemplTextKeeper();
     ~TemplTextKeeper();
 
+    /**
+     * @brief functions the templates may call, if set the validation reports calls of other functions
+     *
+     * Must be called before init().
+     */
+    void set_known_functions( const std::set<std::string> & names );
+
+    /**
+     * @param compress_bodies   keep localized bodies compressed with a dictionary trained on the catalog,
+     *                          templates are compiled on first use then
+     */
     bool init(
-            const std::string & config_file );
+            const std::string & config_file,
+            bool                compress_bodies = false );
+
+    /**
+     * @brief re-reads the config file if it has changed since the last init() or reload()
+     *
+     * The file is split into blocks of lines at content-defined boundaries, only the blocks whose
+     * hash differs from the last load are parsed and only their changed records are compiled again.
+     * The changes are compiled and validated before anything is modified, so on error the previous
+     * state is kept.
+     * Must not be called concurrently with other methods.
+     *
+     * @return false if the file hasn't changed
+     */
+    bool reload();
+
+    /**
+     * @brief returns the issues found by the validation pass of init() and reload()
+     *
+     * The pass runs in parallel over the compiled templates and checks for unbalanced '%func(',
+     * unknown functions, placeholders missing in some locales and templates without localized versions.
+     */
+    Issues get_issues() const;
+
+    CompressionStats get_compression_stats() const;
+
+    /**
+     * @brief enables sampling of template accesses, every rate-th lookup per thread is counted, 0 disables
+     */
+    void set_access_sampling( uint32_t rate );
+
+    /**
+     * @brief saves the loaded and the sampled access counts, hottest first
+     */
+    bool save_profile( const std::string & profile_file ) const;
+
+    /**
+     * @brief loads access counts saved by save_profile()
+     *
+     * If called before init(), the hottest templates are compiled first, so that they and their
+     * segments are packed together in memory. The hot table consulted before the main index
+     * is built in either case. May run concurrently with lookups: the new table is built aside
+     * and replaces the previous one atomically, replaced tables are freed by the next reload().
+     *
+     * @return false if the file cannot be read or has an invalid entry, the previous profile is kept then
+     */
+    bool load_profile( const std::string & profile_file );
 
     Records find_templates(
             uint32_t            * total_size,
@@ -68,10 +153,58 @@ public:
             uint32_t            page_size   = std::numeric_limits<uint32_t>::max(),
             uint32_t            page_num    = 0 ) const;
 
+    /**
+     * @brief typo-tolerant search over name and localized name, best matches first
+     *
+     * The search index is built on the first call, so that processes which never search don't pay for it.
+     *
+     * @param max_distance  max edit distance per word, limited to 1 for words up to 5 characters and to 2 for longer ones
+     */
+    Records search_templates(
+            const std::string   & query,
+            category_id_t       category_id,
+            lang_tools::lang_e  locale,
+            uint32_t            max_results     = 10,
+            uint32_t            max_distance    = 2 ) const;
+
     bool has_template( id_t id, lang_tools::lang_e locale ) const;
     const Templ * get_template( id_t id, lang_tools::lang_e locale ) const;
     const id_t find_template_id_by_name( const std::string & name ) const;
 
+    /**
+     * @brief returns the slot of the placeholder, SlotTempl::INVALID_SLOT if no template uses it
+     *
+     * Slots are interned across the whole catalog and stay stable for the keeper's lifetime,
+     * so they can be resolved once and reused for every format() call.
+     */
+    slot_t get_slot( const std::string & placeholder ) const;
+    uint32_t get_slot_count() const;
+
+    const SlotTempl * get_slot_template( id_t id, lang_tools::lang_e locale ) const;
+
+    /**
+     * @brief formats the template with arguments indexed by slot
+     *
+     * An argument is missing only if its slot is beyond args.size(), unassigned elements
+     * of Args( get_slot_count() ) are formatted as empty strings.
+     *
+     * @throw std::runtime_error if the template doesn't exist or (throw_on_error) an argument is missing
+     */
+    std::string format(
+            id_t                id,
+            lang_tools::lang_e  locale,
+            const Args          & args,
+            bool                throw_on_error = true ) const;
+
+    /**
+     * @brief name-based wrapper around format() with slot arguments
+     */
+    std::string format(
+            id_t                        id,
+            lang_tools::lang_e          locale,
+            const Templ::MapKeyValue    & tokens,
+            bool                        throw_on_error = true ) const;
+
 private:
 
     struct GeneralTemplate
@@ -91,9 +224,16 @@ private:
 
     struct LocalizedTemplateInfo
     {
+        LocalizedTemplateInfo();
+        LocalizedTemplateInfo( const LocalizedTemplateInfo & r );
+
         std::string name;
-        std::string templ;
-        Templ       * t;
+        std::string templ;          // empty if bodies are compressed
+        std::string packed;         // compressed body
+        mutable Templ       * t;    // compiled on first use if bodies are compressed
+        mutable SlotTempl   * st;   // built at load for the validation, then again on first use
+        mutable std::atomic<bool>   is_compiled;    // t and st are set, see find_compiled_templ()
+        uint32_t    estimated_size; // expected size of the formatted text
     };
 
     typedef std::map<lang_tools::lang_e, LocalizedTemplateInfo>    MapLocaleToLocTemplInfo;
@@ -105,27 +245,217 @@ private:
         MapLocaleToLocTemplInfo localized_templ_info;
     };
 
+    struct HotTable
+    {
+        std::vector<uint64_t>                       keys;       // hottest (id, locale)
+        std::vector<const LocalizedTemplateInfo *>  templs;
+    };
+
     typedef std::map<std::string, id_t>     MapTemplNameToTemplId;
     typedef std::map<id_t, TemplateInfo>    MapIdToTemplateInfo;
 
+    typedef std::map<uint64_t, uint32_t>    MapKeyToCount;      // map: (id, locale) --> access count
+
+    typedef std::map<id_t, Issues>          MapIdToIssues;
+
+    static const uint32_t GENERAL_LOCALE    = 0xFFFFFFFF;   // locale part of the record key of a T line
+
+    struct Block
+    {
+        uint32_t                count;      // number of blocks with this content in the file
+        std::vector<uint64_t>   keys;       // records of the block, see to_record_key()
+    };
+
+    typedef std::unordered_map<uint64_t, Block>     MapHashToBlock;     // map: block hash --> block
+    typedef std::unordered_map<uint64_t, uint64_t>  MapKeyToLineHash;   // map: record key --> hash of the line
+
+    class MappedFile
+    {
+    public:
+
+        explicit MappedFile( const std::string & filename );
+        ~MappedFile();
+
+        const char  * get_data() const;
+        size_t      get_size() const;
+
+    private:
+
+        MappedFile( const MappedFile & );
+        MappedFile & operator=( const MappedFile & );
+
+    private:
+
+        const char  * data_;
+        size_t      size_;
+    };
+
+    struct BlockRef
+    {
+        uint64_t    hash;
+        size_t      begin;      // offsets in the file
+        size_t      end;
+    };
+
+    struct Line
+    {
+        size_t      begin;
+        size_t      size;
+        uint64_t    hash;
+    };
+
+    static const uint64_t BLOCK_MASK        = 0xFF;     // a block ends after a line with these hash bits zero, ~256 lines
+    static const uint32_t MAX_BLOCK_LINES   = 4096;
+
+    struct StagedTempl
+    {
+        LocalizedTemplate           e;
+        uint64_t                    hash;           // hash of the line
+        std::string                 packed;
+        uint64_t                    raw_size;
+        uint32_t                    estimated_size;
+        std::unique_ptr<SlotTempl>  st;
+        std::unique_ptr<Templ>      t;
+    };
+
+    typedef std::pair<GeneralTemplate, uint64_t>    GeneralTemplateToHash;
+
+    /**
+     * @brief changes found by reload(), parsed and compiled before the keeper is modified
+     */
+    struct Changes
+    {
+        std::vector<BlockRef>               new_blocks;
+        std::vector<std::vector<uint64_t>>  new_block_keys;
+        std::vector<uint64_t>               vanished_blocks;    // hash of every block no longer in the file
+        std::vector<GeneralTemplateToHash>  changed_t;
+        std::vector<StagedTempl>            changed_l;
+        std::vector<id_t>                   removed_t;
+        std::vector<uint64_t>               removed_l;
+        std::vector<id_t>                   affected_ids;       // templates to validate again
+        MapIdToIssues                       issues;             // new issues of affected_ids
+        SlotTempl::MapNameToSlot            slots;
+        std::vector<std::string>            slot_names;
+    };
+
+    struct LineKey
+    {
+        char                type;
+        id_t                id;
+        lang_tools::lang_e  locale;
+    };
+
+    struct FileStamp
+    {
+        uint64_t    size;
+        int64_t     mtime_sec;
+        int64_t     mtime_nsec;
+
+        bool operator==( const FileStamp & r ) const;
+    };
+
+    static const uint32_t HOT_TABLE_SIZE    = 64;
+
+    static const uint32_t AVG_ARG_SIZE      = 16;       // for the estimation of formatted size
+    static const uint32_t MIN_TEMPLS_PER_THREAD = 1024;
+
 private:
 
     void process_line( const std::string & l );
     void process_line_t( const std::string & l );
     void process_line_l( const std::string & l );
 
-    GeneralTemplate     to_general_templ( const std::string & l );
-    LocalizedTemplate   to_localized_templ( const std::string & l );
+    static GeneralTemplate      to_general_templ( const std::string & l );
+    static LocalizedTemplate    to_localized_templ( const std::string & l );
+
+    void parse_file( const MappedFile & file );
+
+    bool find_changes( const MappedFile & file, Changes * changes ) const;
+    void stage_changes( Changes * changes ) const;
+    void apply_changes( Changes & changes );
+    void update_derived( const Changes & changes );
+    void check_names( const std::vector<GeneralTemplate> & changed_t, const std::vector<id_t> & removed_t ) const;
+
+    static void split_blocks( const MappedFile & file, std::vector<BlockRef> * blocks );
+    static void get_lines( const MappedFile & file, const BlockRef & block, std::vector<Line> * lines );
+    static uint64_t hash_bytes( const char * p, size_t size );
+    static LineKey to_line_key( const std::string & l );
+    static uint64_t to_record_key( const LineKey & k );
+    static bool get_file_stamp( const std::string & filename, FileStamp * stamp );
+
+    void compile_templates();
+    void update_slot_names();
+    void compress_bodies();
+    void build_search_index() const;
+    void ensure_search_index() const;
+    void build_hot_table();
+
+    Issues validate_templates(
+            const std::vector<MapIdToTemplateInfo::value_type *> & templs,
+            const SlotTempl::MapNameToSlot  & registry,
+            const std::vector<std::string>  & slot_names ) const;
+    Issues validate_template(
+            id_t                            id,
+            TemplateInfo                    & info,
+            const Linter                    & linter,
+            const SlotTempl::MapNameToSlot  & registry,
+            const std::vector<std::string>  & slot_names ) const;
+
+    void compile( const LocalizedTemplateInfo & info, const std::string & body, SlotTempl::MapNameToSlot & registry );
+
+    static uint64_t to_key( id_t id, lang_tools::lang_e locale );
+    static id_t to_id( uint64_t key );
+    static lang_tools::lang_e to_locale( uint64_t key );
+
+    MapKeyToCount get_access_counts() const;
+    static std::vector<uint64_t> get_hot_keys( const MapKeyToCount & counts, uint32_t max_size );
+
+    void sample_access( id_t id, lang_tools::lang_e locale, uint32_t rate ) const;
 
-    void parse_lines( const std::vector<std::string> & lines );
+    const LocalizedTemplateInfo * find_localized_templ( id_t id, lang_tools::lang_e locale ) const;
+    const LocalizedTemplateInfo * find_compiled_templ( id_t id, lang_tools::lang_e locale ) const;
+
+    static void release_uncompiled( LocalizedTemplateInfo & info );
+    std::string get_body( const LocalizedTemplateInfo & info ) const;
+
+    Record to_record( const MapIdToTemplateInfo::value_type & t, const MapLocaleToLocTemplInfo::value_type & l ) const;
 
     static bool is_match( const TemplateInfo & c, category_id_t category_id );
     static bool is_match( const MapLocaleToLocTemplInfo::value_type & c, const std::string & name_filter, lang_tools::lang_e lang );
 
 private:
 
+    std::string             config_file_;
+    FileStamp               file_stamp_;
+    MapHashToBlock          blocks_;        // blocks of the file at the last load
+    MapKeyToLineHash        line_hashes_;
+
     MapTemplNameToTemplId   templ_names_;   // map: general template name --> general template id
     MapIdToTemplateInfo     templs_;        // map: general template id --> template info
+    SlotTempl::MapNameToSlot    slots_;     // map: placeholder name --> slot
+    std::vector<std::string>    slot_names_;    // slot --> placeholder name
+
+    bool                    is_compressed_;
+    BodyCodec               codec_;
+    uint64_t                raw_size_;
+    uint64_t                packed_size_;
+
+    mutable SearchIndex         search_index_;
+    mutable std::atomic<bool>   is_search_index_built_;
+    mutable std::mutex          search_index_mutex_;    // guards the build of search_index_
+
+    std::set<std::string>   known_functions_;
+    MapIdToIssues           issues_;
+
+    std::atomic<uint32_t>   sampling_rate_;
+    MapKeyToCount           profile_;           // loaded access counts
+    mutable MapKeyToCount   access_counts_;     // sampled access counts
+    mutable std::mutex      profile_mutex_;
+
+    std::atomic<const HotTable *>           hot_table_;     // scanned before the main index, replaced as a whole
+    std::vector<std::unique_ptr<HotTable>>  hot_tables_;    // current and replaced tables, guarded by profile_mutex_
+
+    mutable std::mutex      mutex_;         // serializes lazy compilation of compressed templates
 };
 
 NAMESPACE_TEMPLTEXTKEEPER_END
@@ -32,6 +32,7 @@ NAMESPACE_TEMPLTEXTKEEPER_START
 
 typedef uint32_t id_t;
 typedef uint32_t category_id_t;
+typedef uint32_t slot_t;        // index of a placeholder in an argument vector
 
 NAMESPACE_TEMPLTEXTKEEPER_END
 